@@ -0,0 +1,50 @@
+#ifndef ALU_H
+#define ALU_H
+#include <stdint.h>
+
+/*
+The register arithmetic every core runs: the CHIP-8 handlers in cpu.c, the
+lane-at-a-time path in batch.c and the SUPER-CHIP and XO-CHIP cores built
+from xchip_core.h all call these rather than keep their own copies, so the
+machines can't drift apart on what 8xy5 means. The vectorised lanes in
+batch.c and the recompiler in jit.c can't call C, and follow the same rules
+by hand:
+
+- 8xy4, 8xy5 and 8xy7 set VF to carry, or NOT borrow, so 8xy5 gives 1 when
+  Vx >= Vy.
+- Vx is written before VF, so with x = F the flag is what remains.
+- 8xy6 and 8xyE shift the value they're given, which is Vx or Vy by the
+  machine's quirk.
+*/
+
+// Run 8xy_ operation n (the low nibble) on Vx and Vy's value. Returns 0 if
+// n isn't one, leaving the registers alone.
+static inline int alu_8xy(uint8_t n, uint8_t *vx, uint8_t vy, uint8_t *vf, int shift_vy) {
+    uint8_t a = *vx, b = vy;
+    uint8_t shifted = shift_vy ? b : a;
+    switch (n) {
+        case 0x0: *vx = b; return 1;
+        case 0x1: *vx = a | b; return 1;
+        case 0x2: *vx = a & b; return 1;
+        case 0x3: *vx = a ^ b; return 1;
+        case 0x4: *vx = a + b; *vf = (uint8_t)(a + b) < a; return 1;
+        case 0x5: *vx = a - b; *vf = a >= b; return 1;
+        case 0x6: *vx = shifted >> 1; *vf = shifted & 1; return 1;
+        case 0x7: *vx = b - a; *vf = b >= a; return 1;
+        case 0xE: *vx = shifted << 1; *vf = shifted >> 7; return 1;
+        default: return 0;
+    }
+}
+
+// One xorshift64* step of a Cxkk generator, returning the top byte as those
+// are the best mixed bits
+static inline uint8_t alu_random_byte(uint64_t *rng_state) {
+    uint64_t x = *rng_state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *rng_state = x;
+    return (x * 0x2545F4914F6CDD1Dull) >> 56;
+}
+
+#endif // ALU_H
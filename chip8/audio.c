@@ -0,0 +1,119 @@
+#include "audio.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#define AUDIO_QUEUE_MASK (AUDIO_QUEUE_SIZE - 1)
+#define AUDIO_PHASE_SHIFT 25 // 32 - log2(AUDIO_WAVETABLE_SIZE)
+
+// one sample per pattern bit, most significant bit of the first byte first
+static void expand_pattern(int16_t *table, uint8_t const *pattern) {
+    for (int i = 0; i < AUDIO_WAVETABLE_SIZE; ++i) {
+        table[i] = (pattern[i >> 3] >> (7 - (i & 7))) & 1 ? AUDIO_VOLUME : -AUDIO_VOLUME;
+    }
+}
+
+// SDL's audio thread. Takes the newest command, then fills the buffer from
+// the wavetable it selects.
+static void audio_callback(void *userdata, Uint8 *stream, int len) {
+    audio_output *audio = userdata;
+
+    uint32_t tail = atomic_load_explicit(&audio->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&audio->head, memory_order_acquire);
+    if (tail != head) {
+        audio_command const *latest = &audio->ring[(head - 1) & AUDIO_QUEUE_MASK];
+        if (latest->xochip && memcmp(latest->pattern, audio->playing.pattern, sizeof(latest->pattern)) != 0) {
+            expand_pattern(audio->pattern_table, latest->pattern);
+        }
+        audio->playing = *latest;
+        atomic_store_explicit(&audio->tail, head, memory_order_release);
+    }
+
+    int16_t *out = (int16_t *)stream;
+    int samples = len / (int)sizeof(*out);
+    if (!audio->playing.on) {
+        memset(out, 0, (size_t)samples * sizeof(*out));
+        return;
+    }
+
+    int16_t const *table = audio->playing.xochip ? audio->pattern_table : audio->beep_table;
+    uint32_t step = audio->playing.xochip ? audio->pitch_step[audio->playing.pitch] : audio->beep_step;
+    uint32_t phase = audio->phase;
+    for (int i = 0; i < samples; ++i) {
+        out[i] = table[phase >> AUDIO_PHASE_SHIFT];
+        phase += step;
+    }
+    audio->phase = phase;
+}
+
+int audio_open(audio_output *audio) {
+    memset(audio, 0, sizeof(*audio));
+
+    // a square wave for the beep, and the XO-CHIP playback rate of
+    // 4000 * 2^((pitch - 64) / 48) bits a second for every pitch
+    for (int i = 0; i < AUDIO_WAVETABLE_SIZE; ++i) {
+        audio->beep_table[i] = i < AUDIO_WAVETABLE_SIZE / 2 ? AUDIO_VOLUME : -AUDIO_VOLUME;
+    }
+    audio->beep_step = (uint32_t)((double)AUDIO_BEEP_HZ * 4294967296.0 / AUDIO_SAMPLE_RATE);
+    for (int pitch = 0; pitch < 256; ++pitch) {
+        double bits_per_second = 4000.0 * pow(2.0, (pitch - 64) / 48.0);
+        audio->pitch_step[pitch] = (uint32_t)(bits_per_second * (double)(1u << AUDIO_PHASE_SHIFT) / AUDIO_SAMPLE_RATE);
+    }
+
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0) {
+        fprintf(stderr, "Audio could not initialise, running silent! SDL_Error: %s\n", SDL_GetError());
+        return -1;
+    }
+
+    SDL_AudioSpec want = { 0 };
+    want.freq = AUDIO_SAMPLE_RATE;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples = AUDIO_BUFFER_SAMPLES;
+    want.callback = audio_callback;
+    want.userdata = audio;
+
+    // no changes allowed, so the callback always gets the format it writes
+    audio->device = SDL_OpenAudioDevice(NULL, 0, &want, NULL, 0);
+    if (audio->device == 0) {
+        fprintf(stderr, "Audio device could not be opened, running silent! SDL_Error: %s\n", SDL_GetError());
+        return -1;
+    }
+    SDL_PauseAudioDevice(audio->device, 0);
+    return 0;
+}
+
+void audio_update(audio_output *audio, int on, uint8_t const *pattern, uint8_t pitch) {
+    if (audio->device == 0) {
+        return;
+    }
+
+    audio_command command = { 0 };
+    command.on = on != 0;
+    if (pattern != NULL) {
+        command.xochip = 1;
+        command.pitch = pitch;
+        memcpy(command.pattern, pattern, sizeof(command.pattern));
+    }
+    if (memcmp(&command, &audio->last, sizeof(command)) == 0) {
+        return;
+    }
+
+    // If the callback has fallen a whole queue behind, leave last alone so
+    // the change is tried again next frame rather than lost
+    uint32_t head = atomic_load_explicit(&audio->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&audio->tail, memory_order_acquire);
+    if (head - tail >= AUDIO_QUEUE_SIZE) {
+        return;
+    }
+    audio->ring[head & AUDIO_QUEUE_MASK] = command;
+    atomic_store_explicit(&audio->head, head + 1, memory_order_release);
+    audio->last = command;
+}
+
+void audio_close(audio_output *audio) {
+    if (audio->device != 0) {
+        SDL_CloseAudioDevice(audio->device);
+        audio->device = 0;
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+#include <SDL2/SDL.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include "xchip.h"
+
+/*
+Sound for the emulator. SDL pulls samples from a callback on its own audio
+thread; the emulation thread tells it what to play once a frame through a
+small single-producer single-consumer ring, and the callback applies the
+newest entry before filling its buffer. Nothing on the callback side locks,
+allocates or does more than a table lookup per sample:
+
+- The CHIP-8 beep is one period of a square wave, computed once at open.
+- An XO-CHIP audio pattern is expanded into its own 128-sample table when
+  it changes, and the step per sample for each pitch is computed up front.
+
+At AUDIO_SAMPLE_RATE with AUDIO_BUFFER_SAMPLES per callback, a change
+reaches the speaker within a buffer (about 5 ms) of the frame it was
+pushed on, plus whatever the driver adds.
+*/
+
+#define AUDIO_SAMPLE_RATE 48000
+#define AUDIO_BUFFER_SAMPLES 256
+#define AUDIO_QUEUE_SIZE 16 // a power of two, frames of commands
+#define AUDIO_WAVETABLE_SIZE 128 // one bit of an XO-CHIP pattern per sample
+#define AUDIO_BEEP_HZ 440
+#define AUDIO_VOLUME 3000
+
+typedef struct {
+    uint8_t on; // sound timer nonzero
+    uint8_t xochip; // play pattern at pitch, rather than the beep
+    uint8_t pitch;
+    uint8_t pattern[XCHIP_AUDIO_PATTERN];
+} audio_command;
+
+typedef struct {
+    SDL_AudioDeviceID device; // 0 when audio couldn't be opened
+
+    // emulation thread to callback
+    audio_command ring[AUDIO_QUEUE_SIZE];
+    _Atomic uint32_t head; // advanced by the emulation thread
+    _Atomic uint32_t tail; // advanced by the callback
+    audio_command last; // emulation thread: the last command pushed
+
+    // callback only
+    audio_command playing;
+    int16_t pattern_table[AUDIO_WAVETABLE_SIZE];
+    uint32_t phase; // position in the wavetable, top 7 bits index it
+
+    // read-only once open
+    int16_t beep_table[AUDIO_WAVETABLE_SIZE];
+    uint32_t beep_step;
+    uint32_t pitch_step[256]; // phase step per sample for each XO-CHIP pitch
+} audio_output;
+
+// Open the default audio device and start it playing silence. On failure
+// prints why and returns -1, leaving audio_update and audio_close harmless.
+int audio_open(audio_output *audio);
+
+// Emulation thread: call once a frame with the machine's sound state. pattern
+// is the XO-CHIP audio pattern, or NULL for the CHIP-8 beep. Only changes
+// reach the callback.
+void audio_update(audio_output *audio, int on, uint8_t const *pattern, uint8_t pitch);
+
+void audio_close(audio_output *audio);
+
+#endif // AUDIO_H
@@ -0,0 +1,765 @@
+#include "batch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "alu.h"
+#include "cpu.h"
+
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+// Each lane's memory is padded by a cache line, or every lane's copy of an
+// address would fall in the same cache set and Dxyn across the group would
+// miss on every sprite row
+#define LANE_MEMORY_STRIDE (MEMORY_SPACE + 64)
+
+// One group of lanes. Registers are [register][lane] so each one is a
+// single vector across the group; memory and the screen are per lane, as
+// they're only touched by the per-lane loops.
+typedef struct {
+    uint8_t v_register[NUM_V_REG][BATCH_LANES];
+    uint16_t program_counter[BATCH_LANES];
+    uint16_t index_register[BATCH_LANES];
+    uint16_t stack[STACK_DEPTH][BATCH_LANES];
+    uint8_t stack_pointer[BATCH_LANES];
+    uint8_t delay_timer[BATCH_LANES];
+    uint8_t sound_timer[BATCH_LANES];
+    uint16_t keys[BATCH_LANES];
+    uint16_t opcode[BATCH_LANES]; // the last instruction executed
+    uint64_t rng_state[BATCH_LANES];
+    uint32_t remaining[BATCH_LANES]; // instructions left in this batch_run
+    uint32_t rounds[BATCH_LANES]; // rounds the lane has been in this batch_run
+    uint64_t memory_hash[BATCH_LANES]; // as chip8_state's, kept up to date by lane_store
+
+    uint8_t written[MEMORY_SPACE]; // nonzero where some lane has stored
+    uint8_t lanes_at[MEMORY_SPACE]; // lanes with instructions left at each PC, outside the round running
+    uint8_t memory[BATCH_LANES][LANE_MEMORY_STRIDE];
+    uint64_t video[BATCH_LANES][VIDEO_ROWS];
+} __attribute__((aligned(64))) batch_group;
+
+struct chip8_batch {
+    size_t lanes;
+    size_t num_groups;
+    batch_group *groups;
+    void (*run)(batch_group *g); // run_group, or a build of it for the host
+};
+
+// A whole group's worth of one register. The arithmetic is done on these
+// rather than lane by lane so it's vector code whatever the compiler's
+// vectoriser makes of it; GCC splits them to fit the target's registers.
+typedef uint8_t lanes8 __attribute__((vector_size(BATCH_LANES)));
+typedef uint16_t lanes16 __attribute__((vector_size(2 * BATCH_LANES)));
+typedef int8_t mask8 __attribute__((vector_size(BATCH_LANES)));
+typedef int16_t mask16 __attribute__((vector_size(2 * BATCH_LANES)));
+
+// The lane arrays of a group, read and written as whole vectors
+typedef lanes8 lanes8_array __attribute__((aligned(1), may_alias));
+typedef lanes16 lanes16_array __attribute__((aligned(1), may_alias));
+#define LANES8(array) (*(lanes8_array *)(array))
+#define LANES16(array) (*(lanes16_array *)(array))
+
+#define WIDEN(v) __builtin_convertvector((v), lanes16)
+#define WIDEN_MASK(m) ((lanes16)__builtin_convertvector((mask8)(m), mask16))
+
+// a where m is set, b elsewhere
+#define SELECT(m, a, b) (((a) & (m)) | ((b) & ~(m)))
+
+// The per-lane instructions, run for each lane l in the step. They mirror
+// the op_* handlers in cpu.c, which stay the reference.
+
+static void lane_unknown(batch_group *g, int l, uint16_t opcode) {
+    (void)g;
+    (void)l;
+    printf("Unknown opcode: 0x%X\n", opcode);
+}
+
+static void lane_00E0(batch_group *g, int l) {
+    memset(g->video[l], 0, sizeof(g->video[l]));
+}
+
+static void lane_00EE(batch_group *g, int l) {
+    g->stack_pointer[l]--;
+    g->program_counter[l] = g->stack[g->stack_pointer[l] & STACK_MASK][l];
+}
+
+static void lane_2nnn(batch_group *g, int l, uint16_t nnn) {
+    g->stack[g->stack_pointer[l] & STACK_MASK][l] = g->program_counter[l];
+    g->stack_pointer[l]++;
+    g->program_counter[l] = nnn;
+}
+
+static void lane_Cxkk(batch_group *g, int l, uint8_t x, uint8_t kk) {
+    g->v_register[x][l] = alu_random_byte(&g->rng_state[l]) & kk;
+}
+
+static void lane_Dxyn(batch_group *g, int l, uint8_t x, uint8_t y, uint8_t n) {
+    uint8_t xPos = g->v_register[x][l] % VIDEO_COLS;
+    uint8_t yPos = g->v_register[y][l] % VIDEO_ROWS;
+    uint16_t index = g->index_register[l];
+    g->v_register[0xF][l] = 0;
+
+    uint64_t collision = 0;
+    for (unsigned int row = 0; row < n; ++row) {
+        uint64_t sprite = (uint64_t)g->memory[l][(index + row) & ADDRESS_MASK] << 56;
+        sprite = (sprite >> xPos) | (sprite << ((VIDEO_COLS - xPos) & (VIDEO_COLS - 1)));
+        uint64_t *line = &g->video[l][(yPos + row) % VIDEO_ROWS];
+        collision |= *line & sprite;
+        *line ^= sprite;
+    }
+    if (collision) {
+        g->v_register[0xF][l] = 1;
+    }
+}
+
+static void lane_Fx0A(batch_group *g, int l, uint8_t x) {
+    if (g->keys[l]) {
+        g->v_register[x][l] = __builtin_ctz(g->keys[l]);
+    } else {
+        g->program_counter[l] -= 2;
+    }
+}
+
+static void lane_store(batch_group *g, int l, uint16_t address, uint8_t value) {
+    address &= ADDRESS_MASK;
+    g->memory_hash[l] += emu_memory_term(address, value) - emu_memory_term(address, g->memory[l][address]);
+    g->memory[l][address] = value;
+    g->written[address] = 1;
+}
+
+static void lane_Fx33(batch_group *g, int l, uint8_t x) {
+    uint8_t val = g->v_register[x][l];
+    uint16_t index = g->index_register[l];
+    lane_store(g, l, index + 2, val % 10);
+    lane_store(g, l, index + 1, val / 10 % 10);
+    lane_store(g, l, index, val / 100);
+}
+
+static void lane_Fx55(batch_group *g, int l, uint8_t x) {
+    for (uint8_t i = 0; i <= x; ++i) {
+        lane_store(g, l, g->index_register[l] + i, g->v_register[i][l]);
+    }
+}
+
+static void lane_Fx65(batch_group *g, int l, uint8_t x) {
+    for (uint8_t i = 0; i <= x; ++i) {
+        g->v_register[i][l] = g->memory[l][(g->index_register[l] + i) & ADDRESS_MASK];
+    }
+}
+
+// Fx0A or Fx07 just ran in lane l, which has cycles left in this run. If
+// that left it idle, as emu_skip_idle has it, move it to where spending
+// them would and return 1.
+static int lane_skip_idle(batch_group *g, int l, uint16_t opcode, uint32_t cycles) {
+    if ((opcode & 0xF0FFu) == 0xF00Au) {
+        return g->keys[l] == 0;
+    }
+
+    // loop: Fx07, 3xkk / 4xkk, 1nnn back to loop, with DT not leaving it
+    uint16_t loop = (g->program_counter[l] - 2) & ADDRESS_MASK;
+    if (loop > MEMORY_SPACE - 6) {
+        return 0;
+    }
+    uint8_t const *code = &g->memory[l][loop];
+    uint16_t test = (code[2] << 8) | code[3];
+    uint16_t jump = (code[4] << 8) | code[5];
+    uint8_t dt = g->delay_timer[l];
+    if (jump != (0x1000u | loop) || (test & 0x0F00u) != (opcode & 0x0F00u)) {
+        return 0;
+    }
+    if (!((test >> 12 == 0x3 && dt != (test & 0xFFu)) || (test >> 12 == 0x4 && dt == (test & 0xFFu)))) {
+        return 0;
+    }
+
+    uint16_t opcodes[3] = { opcode, test, jump };
+    g->program_counter[l] = loop + 2 * ((1 + cycles) % 3);
+    g->opcode[l] = opcodes[cycles % 3];
+    return 1;
+}
+
+// Execute opcode in lane l alone, as execute would with only l in the mask,
+// for rounds that are down to one lane
+static ALWAYS_INLINE void lane_execute(batch_group *g, int l, uint16_t opcode) {
+    uint8_t x = (opcode & 0x0F00u) >> 8;
+    uint8_t y = (opcode & 0x00F0u) >> 4;
+    uint8_t kk = opcode & 0x00FFu;
+    uint8_t n = opcode & 0x000Fu;
+    uint16_t nnn = opcode & 0x0FFFu;
+    uint8_t *vx = &g->v_register[x][l];
+    uint8_t *vy = &g->v_register[y][l];
+    uint8_t *vf = &g->v_register[0xF][l];
+    uint16_t *pc = &g->program_counter[l];
+
+    *pc += 2;
+    switch (opcode >> 12) {
+        case 0x0:
+            if (kk == 0xE0) {
+                lane_00E0(g, l);
+            } else if (kk == 0xEE) {
+                lane_00EE(g, l);
+            } else {
+                lane_unknown(g, l, opcode);
+            }
+            break;
+        case 0x1:
+            *pc = nnn;
+            break;
+        case 0x2:
+            lane_2nnn(g, l, nnn);
+            break;
+        case 0x3:
+            *pc += *vx == kk ? 2 : 0;
+            break;
+        case 0x4:
+            *pc += *vx != kk ? 2 : 0;
+            break;
+        case 0x5:
+            *pc += *vx == *vy ? 2 : 0;
+            break;
+        case 0x6:
+            *vx = kk;
+            break;
+        case 0x7:
+            *vx += kk;
+            break;
+        case 0x8:
+            if (!alu_8xy(n, vx, *vy, vf, 0)) {
+                lane_unknown(g, l, opcode);
+            }
+            break;
+        case 0x9:
+            *pc += *vx != *vy ? 2 : 0;
+            break;
+        case 0xA:
+            g->index_register[l] = nnn;
+            break;
+        case 0xB:
+            *pc = g->v_register[0][l] + nnn;
+            break;
+        case 0xC:
+            lane_Cxkk(g, l, x, kk);
+            break;
+        case 0xD:
+            lane_Dxyn(g, l, x, y, n);
+            break;
+        case 0xE: {
+            int down = (g->keys[l] >> (*vx & KEY_MASK)) & 1;
+            if (kk == 0x9E) {
+                *pc += down ? 2 : 0;
+            } else if (kk == 0xA1) {
+                *pc += down ? 0 : 2;
+            } else {
+                lane_unknown(g, l, opcode);
+            }
+            break;
+        }
+        case 0xF:
+            switch (kk) {
+                case 0x07:
+                    *vx = g->delay_timer[l];
+                    break;
+                case 0x0A:
+                    lane_Fx0A(g, l, x);
+                    break;
+                case 0x15:
+                    g->delay_timer[l] = *vx;
+                    break;
+                case 0x18:
+                    g->sound_timer[l] = *vx;
+                    break;
+                case 0x1E:
+                    g->index_register[l] += *vx;
+                    break;
+                case 0x29:
+                    g->index_register[l] = *vx * 5 + FONT_OFFSET;
+                    break;
+                case 0x33:
+                    lane_Fx33(g, l, x);
+                    break;
+                case 0x55:
+                    lane_Fx55(g, l, x);
+                    break;
+                case 0x65:
+                    lane_Fx65(g, l, x);
+                    break;
+                default:
+                    lane_unknown(g, l, opcode);
+                    break;
+            }
+            break;
+    }
+}
+
+// run statement for every lane l in the round, the set bits of lanes
+#define EACH_LANE(statement) do { \
+        for (uint32_t each = lanes; each != 0; each &= each - 1) { \
+            int l = __builtin_ctz(each); \
+            statement; \
+        } \
+    } while (0)
+
+// nonzero if any lane of *v is
+static ALWAYS_INLINE int any_lane(lanes8 const *v) {
+    uint64_t words[BATCH_LANES / 8];
+    memcpy(words, v, sizeof(words));
+    uint64_t any = 0;
+    for (int i = 0; i < BATCH_LANES / 8; ++i) {
+        any |= words[i];
+    }
+    return any != 0;
+}
+
+// nonzero unless every lane in lanes is at the same PC
+static ALWAYS_INLINE int lanes_parted(batch_group const *g, uint32_t lanes) {
+    uint16_t pc = g->program_counter[__builtin_ctz(lanes)];
+    int parted = 0;
+    EACH_LANE(parted |= g->program_counter[l] != pc);
+    return parted;
+}
+
+// Execute opcode in the lanes set in *mask (0xFF, others 0), which are the
+// set bits of lanes. Each register is loaded, updated for the lanes in the
+// mask, and stored back in the same order the op_* handler touches it, so x
+// or y being F behaves the same. Returns nonzero if the lanes may have gone
+// separate ways, or stopped at a Fx07 or Fx0A that might leave them idle.
+static ALWAYS_INLINE int execute(batch_group *g, uint16_t opcode, lanes8 const *mask, uint32_t lanes) {
+    lanes8 m = *mask;
+    int parted = 0;
+    uint8_t x = (opcode & 0x0F00u) >> 8;
+    uint8_t y = (opcode & 0x00F0u) >> 4;
+    uint8_t kk = opcode & 0x00FFu;
+    uint8_t n = opcode & 0x000Fu;
+    uint16_t nnn = opcode & 0x0FFFu;
+    uint8_t *vx = g->v_register[x];
+    uint8_t *vy = g->v_register[y];
+    uint8_t *vf = g->v_register[0xF];
+    lanes16 m16 = WIDEN_MASK(m);
+    lanes16 zero16 = { 0 };
+    lanes8 zero8 = { 0 };
+
+    // Increment the PC before executing, as emu_cycle does
+    lanes16 pc = LANES16(g->program_counter) + (m16 & 2);
+    LANES16(g->program_counter) = pc;
+
+    // lanes in m where cond holds skip the next instruction
+#define SKIP_IF(cond) do { \
+        lanes8 skip = (lanes8)(cond) & m, stay = m & ~skip; \
+        LANES16(g->program_counter) = pc + (WIDEN_MASK(skip) & 2); \
+        parted = any_lane(&skip) && any_lane(&stay); \
+    } while (0)
+
+    switch (opcode >> 12) {
+        case 0x0:
+            if (kk == 0xE0) {
+                EACH_LANE(lane_00E0(g, l));
+            } else if (kk == 0xEE) {
+                EACH_LANE(lane_00EE(g, l));
+                parted = lanes_parted(g, lanes);
+            } else {
+                EACH_LANE(lane_unknown(g, l, opcode));
+            }
+            break;
+        case 0x1:
+            LANES16(g->program_counter) = SELECT(m16, zero16 + nnn, pc);
+            break;
+        case 0x2:
+            EACH_LANE(lane_2nnn(g, l, nnn));
+            break;
+        case 0x3:
+            SKIP_IF(LANES8(vx) == kk);
+            break;
+        case 0x4:
+            SKIP_IF(LANES8(vx) != kk);
+            break;
+        case 0x5:
+            SKIP_IF(LANES8(vx) == LANES8(vy));
+            break;
+        case 0x6:
+            LANES8(vx) = SELECT(m, zero8 + kk, LANES8(vx));
+            break;
+        case 0x7:
+            LANES8(vx) = SELECT(m, LANES8(vx) + kk, LANES8(vx));
+            break;
+        case 0x8: {
+            lanes8 a = LANES8(vx), b = LANES8(vy);
+            switch (n) {
+                case 0x0:
+                    LANES8(vx) = SELECT(m, b, a);
+                    break;
+                case 0x1:
+                    LANES8(vx) = SELECT(m, a | b, a);
+                    break;
+                case 0x2:
+                    LANES8(vx) = SELECT(m, a & b, a);
+                    break;
+                case 0x3:
+                    LANES8(vx) = SELECT(m, a ^ b, a);
+                    break;
+                // as alu_8xy, Vx first and then VF
+                case 0x4: {
+                    lanes8 sum = a + b;
+                    LANES8(vx) = SELECT(m, sum, a);
+                    LANES8(vf) = SELECT(m, (lanes8)(sum < a) & 1, LANES8(vf));
+                    break;
+                }
+                case 0x5:
+                    LANES8(vx) = SELECT(m, a - b, a);
+                    LANES8(vf) = SELECT(m, (lanes8)(a >= b) & 1, LANES8(vf));
+                    break;
+                case 0x6:
+                    LANES8(vx) = SELECT(m, a >> 1, a);
+                    LANES8(vf) = SELECT(m, a & 1, LANES8(vf));
+                    break;
+                case 0x7:
+                    LANES8(vx) = SELECT(m, b - a, a);
+                    LANES8(vf) = SELECT(m, (lanes8)(b >= a) & 1, LANES8(vf));
+                    break;
+                case 0xE:
+                    LANES8(vx) = SELECT(m, a << 1, a);
+                    LANES8(vf) = SELECT(m, a >> 7, LANES8(vf));
+                    break;
+                default:
+                    EACH_LANE(lane_unknown(g, l, opcode));
+                    break;
+            }
+            break;
+        }
+        case 0x9:
+            SKIP_IF(LANES8(vx) != LANES8(vy));
+            break;
+        case 0xA:
+            LANES16(g->index_register) = SELECT(m16, zero16 + nnn, LANES16(g->index_register));
+            break;
+        case 0xB:
+            LANES16(g->program_counter) = SELECT(m16, WIDEN(LANES8(g->v_register[0])) + nnn, pc);
+            parted = lanes_parted(g, lanes);
+            break;
+        case 0xC:
+            EACH_LANE(lane_Cxkk(g, l, x, kk));
+            break;
+        case 0xD:
+            EACH_LANE(lane_Dxyn(g, l, x, y, n));
+            break;
+        case 0xE: {
+            uint8_t held[BATCH_LANES];
+            for (int l = 0; l < BATCH_LANES; ++l) {
+                held[l] = (g->keys[l] >> (vx[l] & KEY_MASK)) & 1 ? 0xFF : 0;
+            }
+            lanes8 down = LANES8(held);
+            if (kk == 0x9E) {
+                SKIP_IF(down);
+            } else if (kk == 0xA1) {
+                SKIP_IF(~down);
+            } else {
+                EACH_LANE(lane_unknown(g, l, opcode));
+            }
+            break;
+        }
+        case 0xF:
+            switch (kk) {
+                case 0x07:
+                    LANES8(vx) = SELECT(m, LANES8(g->delay_timer), LANES8(vx));
+                    parted = 1;
+                    break;
+                case 0x0A:
+                    EACH_LANE(lane_Fx0A(g, l, x));
+                    parted = 1;
+                    break;
+                case 0x15:
+                    LANES8(g->delay_timer) = SELECT(m, LANES8(vx), LANES8(g->delay_timer));
+                    break;
+                case 0x18:
+                    LANES8(g->sound_timer) = SELECT(m, LANES8(vx), LANES8(g->sound_timer));
+                    break;
+                case 0x1E:
+                    LANES16(g->index_register) = LANES16(g->index_register) + (WIDEN(LANES8(vx)) & m16);
+                    break;
+                case 0x29:
+                    LANES16(g->index_register) = SELECT(m16, WIDEN(LANES8(vx)) * 5 + FONT_OFFSET, LANES16(g->index_register));
+                    break;
+                case 0x33:
+                    EACH_LANE(lane_Fx33(g, l, x));
+                    break;
+                case 0x55:
+                    EACH_LANE(lane_Fx55(g, l, x));
+                    break;
+                case 0x65:
+                    EACH_LANE(lane_Fx65(g, l, x));
+                    break;
+                default:
+                    EACH_LANE(lane_unknown(g, l, opcode));
+                    break;
+            }
+            break;
+    }
+#undef SKIP_IF
+    return parted;
+}
+
+// Run every lane in the group until its remaining count is spent.
+//
+// Each round takes the lanes at the lowest PC and runs them together until
+// they go separate ways, one of them runs out, or they reach a PC another
+// lane is waiting at (lanes_at), which joins it to the next round. A round of one lane
+// runs through lane_execute instead, without the vector overhead. The
+// bookkeeping is plain loops over the lanes, which GCC vectorises; compares
+// of the wider vector types are split into scalars, so they're avoided.
+static ALWAYS_INLINE void run_group_body(batch_group *g) {
+    for (;;) {
+        // the lowest PC among lanes with instructions left, past 0xFFFF if none
+        uint32_t lowest = UINT32_MAX;
+        for (int l = 0; l < BATCH_LANES; ++l) {
+            uint32_t key = g->program_counter[l] | ((uint32_t)(g->remaining[l] == 0) << 16);
+            lowest = key < lowest ? key : lowest;
+        }
+        if (lowest > UINT16_MAX) {
+            return;
+        }
+
+        // The lanes there and the fewest instructions any of them has left,
+        // and where the others wait. Branch-free, as which lanes are where
+        // is anyone's guess.
+        uint8_t step[BATCH_LANES];
+        uint32_t budget = UINT32_MAX, lanes = 0;
+        for (int l = 0; l < BATCH_LANES; ++l) {
+            uint32_t active = g->remaining[l] != 0;
+            uint32_t here = active & (g->program_counter[l] == lowest);
+            uint32_t left = g->remaining[l] | (here - 1);
+            step[l] = -here;
+            budget = left < budget ? left : budget;
+            lanes |= here << l;
+        }
+        int leader = __builtin_ctz(lanes);
+        uint32_t round = lanes;
+        g->lanes_at[lowest & ADDRESS_MASK] -= __builtin_popcount(lanes);
+
+        uint32_t done = 0;
+        uint16_t opcode = 0;
+        lanes8 m = LANES8(step);
+        if ((lanes & (lanes - 1)) == 0) {
+            // on its own a lane only ever reads its own memory
+            uint8_t const *memory = g->memory[leader];
+            for (;;) {
+                uint16_t pc = g->program_counter[leader];
+                opcode = (memory[pc & ADDRESS_MASK] << 8) | memory[(pc + 1) & ADDRESS_MASK];
+                lane_execute(g, leader, opcode);
+                ++done;
+                if (done == budget || g->lanes_at[g->program_counter[leader] & ADDRESS_MASK] ||
+                    (opcode & 0xF0FFu) == 0xF007u || (opcode & 0xF0FFu) == 0xF00Au) {
+                    break;
+                }
+            }
+        } else {
+            for (;;) {
+                // The instruction is the same in every lane unless one of
+                // them has stored over it. Then only the lanes that agree
+                // with the leader go, as a round of their own.
+                uint16_t pc = g->program_counter[leader];
+                uint16_t a = pc & ADDRESS_MASK, b = (pc + 1) & ADDRESS_MASK;
+                opcode = (g->memory[leader][a] << 8) | g->memory[leader][b];
+                int split = 0;
+                if (g->written[a] || g->written[b]) {
+                    EACH_LANE(split |= ((g->memory[l][a] << 8) | g->memory[l][b]) != opcode);
+                }
+                if (split && done > 0) {
+                    break;
+                }
+                if (split) {
+                    for (int l = 0; l < BATCH_LANES; ++l) {
+                        if (((g->memory[l][a] << 8) | g->memory[l][b]) != opcode) {
+                            step[l] = 0;
+                            lanes &= ~(1u << l);
+                        }
+                    }
+                    m = LANES8(step);
+                }
+
+                int parted = execute(g, opcode, &m, lanes);
+                ++done;
+                if (parted || split || done == budget || g->lanes_at[g->program_counter[leader] & ADDRESS_MASK]) {
+                    break;
+                }
+            }
+        }
+
+        // what the last instruction was is only needed once a round ends
+        for (int l = 0; l < BATCH_LANES; ++l) {
+            g->remaining[l] -= done & (uint32_t)(int8_t)step[l];
+            g->rounds[l] += step[l] & 1;
+            g->opcode[l] = step[l] ? opcode : g->opcode[l];
+        }
+
+        // lanes that went idle have nothing left to do in this run
+        if ((opcode & 0xF0FFu) == 0xF00Au || (opcode & 0xF0FFu) == 0xF007u) {
+            EACH_LANE(if (g->remaining[l] && lane_skip_idle(g, l, opcode, g->remaining[l])) g->remaining[l] = 0);
+        }
+
+        lanes = round;
+        EACH_LANE(g->lanes_at[g->program_counter[l] & ADDRESS_MASK] += g->remaining[l] != 0);
+    }
+}
+
+static void run_group(batch_group *g) {
+    run_group_body(g);
+}
+
+// Hosts with AVX2 get a copy of the same loop built for it, picked once
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__((target("avx2"))) static void run_group_avx2(batch_group *g) {
+    run_group_body(g);
+}
+#endif
+
+chip8_batch *batch_create(size_t lanes, uint64_t const *seeds) {
+    chip8_batch *batch = calloc(1, sizeof(chip8_batch));
+    if (batch == NULL) {
+        return NULL;
+    }
+    batch->lanes = lanes;
+    batch->run = run_group;
+#if defined(__x86_64__) && defined(__GNUC__)
+    if (__builtin_cpu_supports("avx2")) {
+        batch->run = run_group_avx2;
+    }
+#endif
+    batch->num_groups = (lanes + BATCH_LANES - 1) / BATCH_LANES;
+    batch->groups = aligned_alloc(64, batch->num_groups * sizeof(batch_group));
+    if (batch->groups == NULL) {
+        free(batch);
+        return NULL;
+    }
+    memset(batch->groups, 0, batch->num_groups * sizeof(batch_group));
+
+    // spare lanes in the last group are never given any cycles
+    for (size_t lane = 0; lane < batch->num_groups * BATCH_LANES; ++lane) {
+        batch_group *g = &batch->groups[lane / BATCH_LANES];
+        int l = lane % BATCH_LANES;
+        g->program_counter[l] = PROGRAM_OFFSET;
+        g->rng_state[l] = rng_seed(lane < lanes ? seeds[lane] : 0);
+    }
+    return batch;
+}
+
+void batch_destroy(chip8_batch *batch) {
+    if (batch == NULL) {
+        return;
+    }
+    free(batch->groups);
+    free(batch);
+}
+
+int batch_load_rom(chip8_batch *batch, char const *fileName) {
+    // memory as initialise_state and loadROM leave it, copied into every lane
+    chip8_state *image = aligned_alloc(64, sizeof(chip8_state));
+    if (image == NULL) {
+        return ROM_ERR_MAP;
+    }
+    initialise_state(image, 0);
+    int rom_error = loadROM(fileName, image);
+    if (rom_error == ROM_OK) {
+        emu_rehash_memory(image);
+        for (size_t i = 0; i < batch->num_groups; ++i) {
+            batch_group *g = &batch->groups[i];
+            for (int l = 0; l < BATCH_LANES; ++l) {
+                memcpy(g->memory[l], image->memory, MEMORY_SPACE);
+                g->memory_hash[l] = image->memory_hash;
+            }
+            memset(g->written, 0, sizeof(g->written));
+        }
+    }
+    free(image);
+    return rom_error;
+}
+
+void batch_run(chip8_batch *batch, uint32_t const *cycles) {
+    for (size_t i = 0; i < batch->num_groups; ++i) {
+        batch_group *g = &batch->groups[i];
+        for (int l = 0; l < BATCH_LANES; ++l) {
+            size_t lane = i * BATCH_LANES + l;
+            g->remaining[l] = lane < batch->lanes ? cycles[lane] : 0;
+            g->rounds[l] = 0;
+            g->lanes_at[g->program_counter[l] & ADDRESS_MASK] += g->remaining[l] != 0;
+        }
+        batch->run(g);
+    }
+}
+
+void batch_tick_timers(chip8_batch *batch, size_t lane) {
+    batch_group *g = &batch->groups[lane / BATCH_LANES];
+    int l = lane % BATCH_LANES;
+    if (g->delay_timer[l] > 0) {
+        --g->delay_timer[l];
+    }
+    if (g->sound_timer[l] > 0) {
+        --g->sound_timer[l];
+    }
+}
+
+uint32_t batch_rounds(chip8_batch const *batch, size_t lane) {
+    return batch->groups[lane / BATCH_LANES].rounds[lane % BATCH_LANES];
+}
+
+uint16_t batch_next_opcode(chip8_batch const *batch, size_t lane) {
+    batch_group const *g = &batch->groups[lane / BATCH_LANES];
+    int l = lane % BATCH_LANES;
+    uint16_t pc = g->program_counter[l];
+    return (g->memory[l][pc & ADDRESS_MASK] << 8) | g->memory[l][(pc + 1) & ADDRESS_MASK];
+}
+
+uint16_t batch_program_counter(chip8_batch const *batch, size_t lane) {
+    return batch->groups[lane / BATCH_LANES].program_counter[lane % BATCH_LANES];
+}
+
+uint64_t batch_state_hash(chip8_batch const *batch, size_t lane) {
+    batch_group const *g = &batch->groups[lane / BATCH_LANES];
+    int l = lane % BATCH_LANES;
+
+    // packed as emu_state_hash packs a chip8_state
+    uint64_t words[STATE_HASH_WORDS] = { 0 };
+    uint8_t v_register[NUM_V_REG];
+    uint16_t stack[STACK_DEPTH];
+    for (int i = 0; i < NUM_V_REG; ++i) {
+        v_register[i] = g->v_register[i][l];
+    }
+    for (int i = 0; i < STACK_DEPTH; ++i) {
+        stack[i] = g->stack[i][l];
+    }
+    memcpy(words, v_register, sizeof(v_register));
+    memcpy(&words[2], stack, sizeof(stack));
+    words[6] = g->index_register[l]
+        | (uint64_t)g->program_counter[l] << 16
+        | (uint64_t)g->stack_pointer[l] << 32
+        | (uint64_t)g->delay_timer[l] << 40
+        | (uint64_t)g->sound_timer[l] << 48;
+    words[7] = g->rng_state[l] ^ ((uint64_t)g->keys[l] << 48);
+    return emu_fold_state_hash(g->memory_hash[l] ^ hash_video_rows(g->video[l]), words);
+}
+
+uint16_t *batch_keys(chip8_batch *batch, size_t lane) {
+    return &batch->groups[lane / BATCH_LANES].keys[lane % BATCH_LANES];
+}
+
+void batch_export(chip8_batch const *batch, size_t lane, chip8_state *state) {
+    batch_group const *g = &batch->groups[lane / BATCH_LANES];
+    int l = lane % BATCH_LANES;
+
+    memset(state, 0, sizeof(*state));
+    for (int i = 0; i < NUM_V_REG; ++i) {
+        state->v_register[i] = g->v_register[i][l];
+    }
+    memcpy(state->memory, g->memory[l], MEMORY_SPACE);
+    state->index_register = g->index_register[l];
+    state->program_counter = g->program_counter[l];
+    for (int i = 0; i < STACK_DEPTH; ++i) {
+        state->stack[i] = g->stack[i][l];
+    }
+    state->stack_pointer = g->stack_pointer[l];
+    state->delay_timer = g->delay_timer[l];
+    state->sound_timer = g->sound_timer[l];
+    memcpy(state->video, g->video[l], sizeof(state->video));
+    state->keys = g->keys[l];
+    state->opcode = g->opcode[l];
+    state->rng_state = g->rng_state[l];
+
+    state->video_dirty = ALL_ROWS_DIRTY;
+    initialise_opcode_tables(state);
+    emu_rehash_memory(state);
+}
@@ -0,0 +1,74 @@
+#ifndef BATCH_H
+#define BATCH_H
+#include <stddef.h>
+#include <stdint.h>
+#include "state.h"
+
+/*
+Many instances of one ROM run in lockstep, for search and fuzzing runs over
+lots of seeds or input scripts. Instances (lanes) are kept in groups of
+BATCH_LANES, each group in structure-of-arrays form: v_register[16][lanes],
+program_counter[lanes] and so on, with each lane's memory and screen in
+their own block.
+
+A group runs in rounds. Each round takes the lanes at the lowest PC and
+executes them together, one instruction for all of them at a time, until a
+skip or return sends them different ways or they catch up with a lane that
+was left waiting. Arithmetic, loads, skips and jumps are branch-free selects
+over the lane arrays, which the compiler turns into vector code, AVX2 where
+the host has it. The rest (drawing, calls, stores, key waits) loop over the
+lanes in the round, and a round of one lane runs a plain interpreter.
+Every lane ends up exactly where running it alone through emu_run would
+leave it.
+
+Lanes that stay together, e.g. a ROM whose seed only changes what it draws,
+run up to several times faster than one at a time, less the more of their
+time goes on per-lane work like drawing. Lanes that spend their time in
+different code, like games given different input, gain nothing and run at
+a fraction of the speed emu_run would; batch_rounds tells the caller when a
+lane has got there, so it can export the lane and carry on with emu_run.
+*/
+
+#define BATCH_LANES 32 // lanes per group, one AVX2 register of bytes
+_Static_assert(BATCH_LANES == 32, "a group's lanes are the bits of a uint32_t");
+
+typedef struct chip8_batch chip8_batch;
+
+// Create lanes instances, each initialised as initialise_state does with
+// its own seed. NULL if out of memory.
+chip8_batch *batch_create(size_t lanes, uint64_t const *seeds);
+
+void batch_destroy(chip8_batch *batch);
+
+// Load the same ROM into every lane, returns ROM_OK or a ROM_ERR_ code
+// (loadROM.h)
+int batch_load_rom(chip8_batch *batch, char const *fileName);
+
+// Run lane n for cycles[n] instructions, every lane to completion. Timers
+// are left alone.
+void batch_run(chip8_batch *batch, uint32_t const *cycles);
+
+// count lane's timers down by one, once per 60 Hz frame
+void batch_tick_timers(chip8_batch *batch, size_t lane);
+
+// the lane's keypad bitmask, to set between runs
+uint16_t *batch_keys(chip8_batch *batch, size_t lane);
+
+// How many rounds the lane took its instructions in over the last
+// batch_run. Each round costs about as much as a few instructions of
+// emu_run, so a lane that only gets a few instructions a round is better
+// exported and run by itself.
+uint32_t batch_rounds(chip8_batch const *batch, size_t lane);
+
+// The lane's PC and the instruction there, and emu_state_hash of the state
+// batch_export would give, without exporting it; for halt checks between
+// runs
+uint16_t batch_program_counter(chip8_batch const *batch, size_t lane);
+uint16_t batch_next_opcode(chip8_batch const *batch, size_t lane);
+uint64_t batch_state_hash(chip8_batch const *batch, size_t lane);
+
+// Copy a lane out into a chip8_state, e.g. to hash it or keep running it
+// alone. The decode cache starts empty.
+void batch_export(chip8_batch const *batch, size_t lane, chip8_state *state);
+
+#endif // BATCH_H
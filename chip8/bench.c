@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "state.h"
+#include "loadROM.h"
+#include "cpu.h"
+#include "jit.h"
+#include "scheduler.h"
+
+/*
+Benchmarks, printed as one JSON document on stdout.
+
+Micro: each op_* handler called directly on a prepared state, execute_opcode
+(decode + dispatch) over a mix of opcodes, and emu_cycle on the same mix
+through the decode cache.
+
+Macro: whole ROMs run headless for a fixed cycle count, on the interpreter
+and, where available, the recompiler. Besides the shipped ROMs there are a
+few synthetic programs that stress one kind of instruction each.
+
+JIT check: the ALU program, the recompiler's best case, on both engines at
+the default frame size, where jit_run is entered every frame. The bench fails
+if the recompiler doesn't beat the interpreter there.
+*/
+
+#define DEFAULT_MICRO_ITERATIONS 2000000
+#define DEFAULT_MACRO_CYCLES 20000000
+
+typedef struct {
+    char const *name;
+    uint16_t opcode;
+} bench_op;
+
+// one representative opcode per handler
+static const bench_op HANDLER_OPS[] = {
+    { "00E0", 0x00E0 }, { "00EE", 0x00EE }, { "1nnn", 0x1200 }, { "2nnn", 0x2200 },
+    { "3xkk", 0x3112 }, { "4xkk", 0x4112 }, { "5xy0", 0x5120 }, { "6xkk", 0x6112 },
+    { "7xkk", 0x7112 }, { "8xy0", 0x8120 }, { "8xy1", 0x8121 }, { "8xy2", 0x8122 },
+    { "8xy3", 0x8123 }, { "8xy4", 0x8124 }, { "8xy5", 0x8125 }, { "8xy6", 0x8126 },
+    { "8xy7", 0x8127 }, { "8xyE", 0x812E }, { "9xy0", 0x9120 }, { "Annn", 0xA300 },
+    { "Bnnn", 0xB200 }, { "Cxkk", 0xC1FF }, { "Dxyn", 0xD125 }, { "Ex9E", 0xE19E },
+    { "ExA1", 0xE1A1 }, { "Fx07", 0xF107 }, { "Fx0A", 0xF10A }, { "Fx15", 0xF115 },
+    { "Fx18", 0xF118 }, { "Fx1E", 0xF11E }, { "Fx29", 0xF129 }, { "Fx33", 0xF133 },
+    { "Fx55", 0xF455 }, { "Fx65", 0xF465 },
+};
+#define NUM_HANDLER_OPS (sizeof(HANDLER_OPS) / sizeof(HANDLER_OPS[0]))
+
+// Synthetic programs, loaded at PROGRAM_OFFSET. Each is an endless loop.
+typedef struct {
+    char const *name;
+    uint16_t const *code;
+    size_t length;
+} synthetic_rom;
+
+// register arithmetic and a skip, the recompiler's best case
+static const uint16_t ALU_MIX[] = {
+    0x6000, 0x6101, 0x8014, 0x7201, 0x8320, 0x8335, 0x8406, 0xA300,
+    0xF41E, 0x8512, 0x8653, 0x3701, 0x1204,
+};
+
+// sprite drawing with wrap, like a game redrawing the playfield
+static const uint16_t DRAW_MIX[] = {
+    0x00E0, 0x6000, 0x6100, 0xA250, 0xD015, 0x7008, 0x7103, 0x3040,
+    0x1208, 0x1200,
+};
+
+// calls, returns, compares and skips
+static const uint16_t BRANCH_MIX[] = {
+    0x6000, 0x2210, 0x7001, 0x3010, 0x1202, 0x1200, 0x0000, 0x0000,
+    0x5010, 0x6100, 0x9010, 0x6100, 0x3005, 0x6100, 0x4005, 0x6100,
+    0x00EE,
+};
+
+// BCD, register dumps and loads through I, the self-modifying-code paths
+static const uint16_t MEMORY_MIX[] = {
+    0x6000, 0xA400, 0xF033, 0xF355, 0xF365, 0x7001, 0xF01E, 0x1202,
+};
+
+static const synthetic_rom SYNTHETIC_ROMS[] = {
+    { "synthetic:alu", ALU_MIX, sizeof(ALU_MIX) / sizeof(ALU_MIX[0]) },
+    { "synthetic:draw", DRAW_MIX, sizeof(DRAW_MIX) / sizeof(DRAW_MIX[0]) },
+    { "synthetic:branch", BRANCH_MIX, sizeof(BRANCH_MIX) / sizeof(BRANCH_MIX[0]) },
+    { "synthetic:memory", MEMORY_MIX, sizeof(MEMORY_MIX) / sizeof(MEMORY_MIX[0]) },
+};
+#define NUM_SYNTHETIC_ROMS (sizeof(SYNTHETIC_ROMS) / sizeof(SYNTHETIC_ROMS[0]))
+
+static const char *const ROM_FILES[] = { "tetris.ch8", "test_opcode.ch8" };
+#define NUM_ROM_FILES (sizeof(ROM_FILES) / sizeof(ROM_FILES[0]))
+
+static void usage(char const *prog) {
+    fprintf(stderr, "Usage: %s [-i <MicroIterations>] [-c <MacroCycles>] [-p <CyclesPerFrame>]\n", prog);
+}
+
+// a state with some plausible register values and I pointing at scratch memory
+static void prepare_state(chip8_state *state) {
+    initialise_state(state, 0);
+    for (int i = 0; i < NUM_V_REG; ++i) {
+        state->v_register[i] = 0x11 * i;
+    }
+    state->index_register = 0x300;
+}
+
+static double bench_handler(chip8_state *state, uint16_t opcode, uint64_t iterations) {
+    prepare_state(state);
+    decoded_instr instr = decode_opcode(opcode);
+
+    double start = monotonic_seconds();
+    for (uint64_t i = 0; i < iterations; ++i) {
+        instr.handler(state, &instr);
+    }
+    return (monotonic_seconds() - start) * 1e9 / iterations;
+}
+
+// execute_opcode and emu_cycle over every handler's opcode in turn. For
+// emu_cycle the mix is laid out in memory and PC reset every pass, so only
+// decode cache hits are measured.
+static double bench_dispatch(chip8_state *state, uint64_t iterations, int cached) {
+    prepare_state(state);
+    for (size_t i = 0; i < NUM_HANDLER_OPS; ++i) {
+        state->memory[PROGRAM_OFFSET + 2 * i] = HANDLER_OPS[i].opcode >> 8;
+        state->memory[PROGRAM_OFFSET + 2 * i + 1] = HANDLER_OPS[i].opcode & 0xFF;
+    }
+
+    uint64_t passes = iterations / NUM_HANDLER_OPS;
+    double start = monotonic_seconds();
+    for (uint64_t pass = 0; pass < passes; ++pass) {
+        for (size_t i = 0; i < NUM_HANDLER_OPS; ++i) {
+            if (cached) {
+                state->program_counter = PROGRAM_OFFSET + 2 * i;
+                emu_cycle(state);
+            } else {
+                state->opcode = HANDLER_OPS[i].opcode;
+                execute_opcode(state);
+            }
+        }
+    }
+    return (monotonic_seconds() - start) * 1e9 / (passes * NUM_HANDLER_OPS);
+}
+
+// Run a loaded program for cycles instructions, returns seconds taken
+static double run_program(chip8_state *state, jit_context *jit, uint64_t cycles, uint64_t cycles_per_frame) {
+    double start = monotonic_seconds();
+    uint64_t executed = 0;
+    while (executed < cycles) {
+        uint64_t chunk = cycles - executed;
+        if (chunk > cycles_per_frame) {
+            chunk = cycles_per_frame;
+        }
+        executed += jit ? jit_run(jit, state, chunk) : emu_run(state, chunk);
+        emu_tick_timers(state);
+    }
+    return monotonic_seconds() - start;
+}
+
+static void print_macro(char const *name, char const *engine, uint64_t cycles, uint64_t cycles_per_frame, double seconds, int last) {
+    double mips = cycles / seconds / 1e6;
+    printf("    { \"rom\": \"%s\", \"engine\": \"%s\", \"cycles\": %llu, \"seconds\": %.6f, "
+           "\"mips\": %.2f, \"ns_per_instruction\": %.3f, \"frames_per_second\": %.0f }%s\n",
+           name, engine, (unsigned long long)cycles, seconds, mips, seconds * 1e9 / cycles,
+           cycles / seconds / cycles_per_frame, last ? "" : ",");
+}
+
+// load one macro benchmark program into a fresh state, returns 0 on success
+static int load_program(chip8_state *state, size_t index) {
+    initialise_state(state, 0);
+    if (index < NUM_ROM_FILES) {
+        int rom_error = loadROM(ROM_FILES[index], state);
+        if (rom_error != ROM_OK) {
+            fprintf(stderr, "Failed to load %s: %s\n", ROM_FILES[index], rom_error_string(rom_error));
+            return -1;
+        }
+        return 0;
+    }
+
+    synthetic_rom const *rom = &SYNTHETIC_ROMS[index - NUM_ROM_FILES];
+    for (size_t i = 0; i < rom->length; ++i) {
+        state->memory[PROGRAM_OFFSET + 2 * i] = rom->code[i] >> 8;
+        state->memory[PROGRAM_OFFSET + 2 * i + 1] = rom->code[i] & 0xFF;
+    }
+    // sprite data for the draw mix
+    memset(state->memory + 0x250, 0xA5, 16);
+    return 0;
+}
+
+// Run the ALU program on both engines at DEFAULT_CYCLES_PER_FRAME and print
+// the JIT check. Returns 0 if the recompiler was faster.
+static int check_jit(chip8_state *state, uint64_t cycles) {
+    size_t alu = NUM_ROM_FILES; // the first synthetic program
+    load_program(state, alu);
+    double interpreted = run_program(state, NULL, cycles, DEFAULT_CYCLES_PER_FRAME);
+    load_program(state, alu);
+    jit_context *jit = jit_create();
+    double compiled = run_program(state, jit, cycles, DEFAULT_CYCLES_PER_FRAME);
+    jit_destroy(jit);
+
+    double speedup = interpreted / compiled;
+    printf("  \"jit_check\": { \"rom\": \"%s\", \"cycles_per_frame\": %d, \"speedup\": %.2f },\n",
+           SYNTHETIC_ROMS[0].name, DEFAULT_CYCLES_PER_FRAME, speedup);
+    if (speedup < 1.0) {
+        fprintf(stderr, "The recompiler is slower than the interpreter on %s at %d cycles per frame\n",
+                SYNTHETIC_ROMS[0].name, DEFAULT_CYCLES_PER_FRAME);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    uint64_t micro_iterations = DEFAULT_MICRO_ITERATIONS;
+    uint64_t macro_cycles = DEFAULT_MACRO_CYCLES;
+    uint64_t cycles_per_frame = DEFAULT_CYCLES_PER_FRAME;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:c:p:")) != -1) {
+        switch (opt) {
+            case 'i':
+                micro_iterations = strtoull(optarg, NULL, 10);
+                break;
+            case 'c':
+                macro_cycles = strtoull(optarg, NULL, 10);
+                break;
+            case 'p':
+                cycles_per_frame = strtoull(optarg, NULL, 10);
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc || micro_iterations < NUM_HANDLER_OPS || macro_cycles == 0 || cycles_per_frame == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    chip8_state *state = aligned_alloc(64, sizeof(chip8_state));
+    if (state == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    printf("{\n  \"micro\": {\n    \"iterations\": %llu,\n    \"handlers_ns\": {\n",
+           (unsigned long long)micro_iterations);
+    for (size_t i = 0; i < NUM_HANDLER_OPS; ++i) {
+        double ns = bench_handler(state, HANDLER_OPS[i].opcode, micro_iterations);
+        printf("      \"%s\": %.3f%s\n", HANDLER_OPS[i].name, ns, i + 1 < NUM_HANDLER_OPS ? "," : "");
+    }
+    printf("    },\n");
+    printf("    \"execute_opcode_ns\": %.3f,\n", bench_dispatch(state, micro_iterations, 0));
+    printf("    \"emu_cycle_ns\": %.3f\n", bench_dispatch(state, micro_iterations, 1));
+    printf("  },\n");
+
+    jit_context *probe = jit_create();
+    int have_jit = probe != NULL;
+    jit_destroy(probe);
+    int failed = have_jit && check_jit(state, macro_cycles) != 0;
+
+    printf("  \"macro\": [\n");
+    size_t num_programs = NUM_ROM_FILES + NUM_SYNTHETIC_ROMS;
+
+    for (size_t p = 0; p < num_programs; ++p) {
+        char const *name = p < NUM_ROM_FILES ? ROM_FILES[p] : SYNTHETIC_ROMS[p - NUM_ROM_FILES].name;
+
+        if (load_program(state, p) != 0) {
+            free(state);
+            return EXIT_FAILURE;
+        }
+        double seconds = run_program(state, NULL, macro_cycles, cycles_per_frame);
+        print_macro(name, "interpreter", macro_cycles, cycles_per_frame, seconds, !have_jit && p + 1 == num_programs);
+
+        if (have_jit) {
+            load_program(state, p);
+            jit_context *jit = jit_create();
+            seconds = run_program(state, jit, macro_cycles, cycles_per_frame);
+            jit_destroy(jit);
+            print_macro(name, "jit", macro_cycles, cycles_per_frame, seconds, p + 1 == num_programs);
+        }
+    }
+    printf("  ]\n}\n");
+
+    free(state);
+    return failed ? EXIT_FAILURE : 0;
+}
@@ -1,116 +1,148 @@
 #include "cpu.h"
-#include <time.h>
+#include "alu.h"
+#include "profile.h"
+#include "stats.h"
+
+uint64_t rng_seed(uint64_t seed) {
+    // splitmix64 the seed so nearby seeds give unrelated streams, and so the
+    // xorshift state is never 0
+    seed += 0x9E3779B97F4A7C15ull;
+    seed = (seed ^ (seed >> 30)) * 0xBF58476D1CE4E5B9ull;
+    seed = (seed ^ (seed >> 27)) * 0x94D049BB133111EBull;
+    seed ^= seed >> 31;
+    return seed ? seed : 1;
+}
+
+// write one byte of memory as the program would
+static inline void store_byte(chip8_state *state, uint16_t address, uint8_t value) {
+    address &= ADDRESS_MASK;
+    state->memory_hash += emu_memory_term(address, value) - emu_memory_term(address, state->memory[address]);
+    state->memory[address] = value;
+}
+
+void emu_rehash_memory(chip8_state *state) {
+    uint64_t hash = 0;
+    for (uint16_t address = 0; address < MEMORY_SPACE; ++address) {
+        hash += emu_memory_term(address, state->memory[address]);
+    }
+    state->memory_hash = hash;
+}
 
-void initialise_state(chip8_state* state)
+void initialise_state(chip8_state* state, uint64_t seed)
 {
 	memset(state, 0, sizeof(chip8_state));
 	state->program_counter = PROGRAM_OFFSET;
+	state->rng_state = rng_seed(seed);
+
+	state->video_dirty = ALL_ROWS_DIRTY;
+	initialise_opcode_tables(state);
 	load_font(state);
+	emu_rehash_memory(state);
 }
 
 // Unique opcodes
-void op_1nnn(chip8_state *state) {
+void op_1nnn(chip8_state *state, decoded_instr const *instr) {
     // Jump to location nnn.
-    uint16_t address = state->opcode & 0x0FFFu;
+    uint16_t address = instr->nnn;
     state->program_counter = address;
 }
 
-void op_2nnn(chip8_state *state) { 
+void op_2nnn(chip8_state *state, decoded_instr const *instr) { 
     // Call subroutine at location nnn. 
-    uint16_t address = state->opcode & 0x0FFFu;
+    uint16_t address = instr->nnn;
 
-	state->stack[state->stack_pointer] = state->program_counter;
+	state->stack[state->stack_pointer & STACK_MASK] = state->program_counter;
 	++state->stack_pointer;
 	state->program_counter = address;
+	if (state->profile) {
+		profile_call(state->profile, address);
+	}
 }
 
-void op_3xkk(chip8_state *state) { 
+void op_3xkk(chip8_state *state, decoded_instr const *instr) { 
     // Skip next instruction if Vx = kk.
-    uint8_t val = state->opcode & 0x00FFu;
-    uint8_t vx_index = (state->opcode & 0x0F00u) >> 8;
+    uint8_t val = instr->kk;
+    uint8_t vx_index = instr->x;
 
     if (state->v_register[vx_index] == val) {
         state->program_counter += 2;
     }
 }
 
-void op_4xkk(chip8_state *state) {
+void op_4xkk(chip8_state *state, decoded_instr const *instr) {
     // Skip next instruction if Vx ! kk.
-    uint8_t val = state->opcode & 0x00FFu;
-    uint8_t vx_index = (state->opcode & 0x0F00u) >> 8;
+    uint8_t val = instr->kk;
+    uint8_t vx_index = instr->x;
 
     if (state->v_register[vx_index] != val) {
         state->program_counter += 2;
     }
 }
 
-void op_5xy0(chip8_state *state) { 
+void op_5xy0(chip8_state *state, decoded_instr const *instr) { 
     // Skip next instruction if Vx = Vy.
-    uint8_t vx_index = (state->opcode & 0x0F00u) >> 8;
-    uint8_t vy_index = (state->opcode & 0x00F0u) >> 4;
+    uint8_t vx_index = instr->x;
+    uint8_t vy_index = instr->y;
 
     if (state->v_register[vx_index] == state->v_register[vy_index]) {
             state->program_counter += 2;
     }
 }
 
-void op_6xkk(chip8_state *state) { 
+void op_6xkk(chip8_state *state, decoded_instr const *instr) { 
     // Set Vx = kk.
-    uint8_t vx_index = (state->opcode & 0x0F00) >> 8;
-    uint8_t kk = state->opcode & 0x00FF;
+    uint8_t vx_index = instr->x;
+    uint8_t kk = instr->kk;
 
     state->v_register[vx_index] = kk;
 }
 
-void op_7xkk(chip8_state *state) { 
+void op_7xkk(chip8_state *state, decoded_instr const *instr) { 
     // Increment Vx by kk.
-    uint8_t vx_index = (state->opcode & 0x0F00) >> 8;
-    uint8_t kk = state->opcode & 0x00FF;
+    uint8_t vx_index = instr->x;
+    uint8_t kk = instr->kk;
 
     state->v_register[vx_index] += kk;
 }
 
-void op_9xy0(chip8_state *state) { 
+void op_9xy0(chip8_state *state, decoded_instr const *instr) { 
     // Skip next instruction if Vx != Vy.
-    uint8_t vx_index = (state->opcode & 0x0F00u) >> 8;
-    uint8_t vy_index = (state->opcode & 0x00F0u) >> 4;
+    uint8_t vx_index = instr->x;
+    uint8_t vy_index = instr->y;
 
     if (state->v_register[vx_index] != state->v_register[vy_index]) {
         state->program_counter += 2;
     }
 }
 
-void op_Annn(chip8_state *state) { 
+void op_Annn(chip8_state *state, decoded_instr const *instr) { 
     // Set I = nnn.
-    uint16_t address = state->opcode & 0x0FFF;
+    uint16_t address = instr->nnn;
     state->index_register = address;
 }
 
-void op_Bnnn(chip8_state *state) { 
+void op_Bnnn(chip8_state *state, decoded_instr const *instr) { 
     // Jump to location nnn + V0.
 
-    uint16_t address = (state->opcode & 0x0FFFu) + state->v_register[0x0];
+    uint16_t address = instr->nnn + state->v_register[0x0];
     state->program_counter = address;
 }
 
-void op_Cxkk(chip8_state *state) {  
+void op_Cxkk(chip8_state *state, decoded_instr const *instr) {  
     // Set Vx = random byte AND kk.
-    uint8_t vx_index = (state->opcode & 0x0F00u) >> 8;
-    uint8_t kk = state->opcode & 0x00FF;
+    uint8_t vx_index = instr->x;
+    uint8_t kk = instr->kk;
     
-    // generate random number, make sure it fits in 8 bits
-    srand(time(NULL));
-    uint8_t random_byte = rand() % 256;
-
+    uint8_t random_byte = alu_random_byte(&state->rng_state);
     state->v_register[vx_index] = random_byte & kk;
 }
 
-void op_Dxyn(chip8_state *state) {  
+void op_Dxyn(chip8_state *state, decoded_instr const *instr) {  
     // Display n-byte sprite starting at memory location I at (Vx, Vy) and
     // set VF = collision when needed.
-    uint8_t Vx = (state->opcode & 0x0F00u) >> 8;
-    uint8_t Vy = (state->opcode & 0x00F0u) >> 4;
-    uint8_t height = state->opcode & 0x000Fu;
+    uint8_t Vx = instr->x;
+    uint8_t Vy = instr->y;
+    uint8_t height = instr->n;
 
     // Wrap xPos and yPos if going beyond screen boundaries
     uint8_t xPos = state->v_register[Vx] % VIDEO_COLS;
@@ -119,277 +151,259 @@ void op_Dxyn(chip8_state *state) {
     // Initialise collision flag
     state->v_register[0xF] = 0;
 
-    // Loop through the rows of the sprite
+    // Each sprite row is one byte, and each screen row is one 64-bit word
+    // with column 0 in the top bit. Placing the byte at column 0 and rotating
+    // it right by xPos puts it in place, wrapping off the right edge back
+    // onto the left. Drawing is then an XOR per row, and any bit the row
+    // and the sprite share is a pixel being turned off, i.e. a collision.
+    uint64_t collision = 0;
     for (unsigned int row = 0; row < height; ++row)
     {
-        // Get the current byte of the sprite from memory
-        uint8_t spriteByte = state->memory[state->index_register + row];
-
-        // Loop through the columns (bits) of the sprite byte
-        // A sprite is 8 pixels wide
-        for (unsigned int col = 0; col < 8; ++col)
-        {
-            // Check if the bit at this column in the sprite byte is set
-            uint8_t spritePixel = spriteByte & (0x80u >> col);
-
-            // Pointer to the screen pixel
-            uint32_t screenIndex = ((yPos + row) % VIDEO_ROWS) * VIDEO_ROWS + ((xPos + col) % VIDEO_COLS);
-            uint32_t* screenPixel = &state->video[screenIndex];
-
-            // If the sprite pixel is on (not zero)
-            if (spritePixel) {
-                // Check if the screen pixel is currently on (white)
-                if (*screenPixel == 0xFFFFFFFF) {
-                    // Collision detected
-                    state->v_register[0xF] = 1;
-                }
-
-                // Draw the sprite pixel by XORing it with the screen pixel
-                *screenPixel ^= 0xFFFFFFFF;
-            }
+        uint64_t sprite = (uint64_t)state->memory[(state->index_register + row) & ADDRESS_MASK] << 56;
+        sprite = (sprite >> xPos) | (sprite << ((VIDEO_COLS - xPos) & (VIDEO_COLS - 1)));
+
+        unsigned int screen_row = (yPos + row) % VIDEO_ROWS;
+        uint64_t *line = &state->video[screen_row];
+        collision |= *line & sprite;
+        *line ^= sprite;
+        if (sprite) {
+            state->video_dirty |= 1u << screen_row;
         }
     }
+
+    if (collision) {
+        state->v_register[0xF] = 1;
+        STATS_ADD(state, sprite_collisions, 1);
+    }
+
+#ifdef CHIP8_STATS
+    if (state->stats) {
+        for (unsigned int row = 0; row < height; ++row) {
+            state->stats->sprite_pixels += __builtin_popcount(state->memory[(state->index_register + row) & ADDRESS_MASK]);
+        }
+    }
+#endif
 }
 
-// 8xy_ grouped opcodes
-void op_8xy0(chip8_state *state) { 
+// 8xy_ grouped opcodes, see alu.h. CHIP-8 shifts Vx in place.
+void op_8xy0(chip8_state *state, decoded_instr const *instr) {
     // Set Vx = Vy.
-    uint8_t vx_index = (state->opcode & 0x0F00u) >> 8;
-    uint8_t vy_index = (state->opcode & 0x00F0u) >> 4;
-
-    state->v_register[vx_index] = state->v_register[vy_index]; 
+    uint8_t *v = state->v_register;
+    alu_8xy(0x0, &v[instr->x], v[instr->y], &v[0xF], 0);
 }
 
-void op_8xy1(chip8_state *state) { 
+void op_8xy1(chip8_state *state, decoded_instr const *instr) {
     // Set Vx = Vx OR Vy.
-    uint8_t vx_index = (state->opcode & 0x0F00u) >> 8;
-    uint8_t vy_index = (state->opcode & 0x00F0u) >> 4;
-
-    state->v_register[vx_index] |= state->v_register[vy_index]; 
+    uint8_t *v = state->v_register;
+    alu_8xy(0x1, &v[instr->x], v[instr->y], &v[0xF], 0);
 }
 
-void op_8xy2(chip8_state *state) { 
+void op_8xy2(chip8_state *state, decoded_instr const *instr) {
     // Set Vx = Vx AND Vy.
-    uint8_t vx_index = (state->opcode & 0x0F00u) >> 8;
-    uint8_t vy_index = (state->opcode & 0x00F0u) >> 4;
-
-    state->v_register[vx_index] &= state->v_register[vy_index]; 
+    uint8_t *v = state->v_register;
+    alu_8xy(0x2, &v[instr->x], v[instr->y], &v[0xF], 0);
 }
 
-void op_8xy3(chip8_state *state) { 
+void op_8xy3(chip8_state *state, decoded_instr const *instr) {
     // Set Vx = Vx XOR Vy.
-    uint8_t vx_index = (state->opcode & 0x0F00u) >> 8;
-    uint8_t vy_index = (state->opcode & 0x00F0u) >> 4;
-
-    state->v_register[vx_index] ^= state->v_register[vy_index]; 
+    uint8_t *v = state->v_register;
+    alu_8xy(0x3, &v[instr->x], v[instr->y], &v[0xF], 0);
 }
-void op_8xy4(chip8_state *state) { 
-    // Set Vx = Vx + Vy, set VF = carry if needed.
-    // carry is needed if the sum can't be stored in 8 bits i.e. exceeds 255
-    uint8_t vx_index = (state->opcode & 0x0F00u) >> 8;
-    uint8_t vy_index = (state->opcode & 0x00F0u) >> 4;
 
-    uint16_t sum = state->v_register[vx_index] + state->v_register[vy_index];
-
-    if (sum > 255) {
-        state->v_register[0xF] = 1;
-    } else {
-        state->v_register[0xF] = 0;
-    }
-    state->v_register[vx_index] = sum % 256;
+void op_8xy4(chip8_state *state, decoded_instr const *instr) {
+    // Set Vx = Vx + Vy, set VF = carry.
+    uint8_t *v = state->v_register;
+    alu_8xy(0x4, &v[instr->x], v[instr->y], &v[0xF], 0);
 }
-void op_8xy5(chip8_state *state) { 
-    // Set Vx = Vx - Vy, set VF = NOT borrow.
-    // If Vx > Vy, then VF is set to 1, otherwise 0. 
-    uint8_t vx_index = (state->opcode & 0x0F00u) >> 8;
-    uint8_t vy_index = (state->opcode & 0x00F0u) >> 4;
-
-    uint16_t diff = state->v_register[vx_index] + state->v_register[vy_index];
-
-    if (state->v_register[vx_index] > state->v_register[vy_index]) {
-        state->v_register[0xF] = 1;
-    } else {
-        state->v_register[0xF] = 0;
-    }
-
-
-    state->v_register[vx_index] = diff;
 
+void op_8xy5(chip8_state *state, decoded_instr const *instr) {
+    // Set Vx = Vx - Vy, set VF = NOT borrow.
+    uint8_t *v = state->v_register;
+    alu_8xy(0x5, &v[instr->x], v[instr->y], &v[0xF], 0);
 }
-void op_8xy6(chip8_state *state) { 
-    // Set Vx = Vx >> 1 (shift right by 1)
-    // save LSB in VF
-    uint8_t vx_index = (state->opcode & 0x0F00u) >> 8;
-
-    state->v_register[0xF] = state->v_register[vx_index] & 0x1;
-    state->v_register[vx_index] >>= 1;
 
+void op_8xy6(chip8_state *state, decoded_instr const *instr) {
+    // Set Vx = Vx >> 1, set VF = the bit shifted out.
+    uint8_t *v = state->v_register;
+    alu_8xy(0x6, &v[instr->x], v[instr->y], &v[0xF], 0);
 }
-void op_8xy7(chip8_state *state) {
-    // Set Vx = Vy - Vx, set VF = NOT borrow. 
-    uint8_t vx_index = (state->opcode & 0x0F00u) >> 8;
-    uint8_t vy_index = (state->opcode & 0x00F0u) >> 4;
-
-	if (state->v_register[vy_index] > state->v_register[vx_index])
-	{
-		state->v_register[0xF] = 1;
-	}
-	else
-	{
-		state->v_register[0xF] = 0;
-	}
-
-    uint16_t diff = state->v_register[vy_index] - state->v_register[vx_index];
-	state->v_register[vx_index] = diff;
 
+void op_8xy7(chip8_state *state, decoded_instr const *instr) {
+    // Set Vx = Vy - Vx, set VF = NOT borrow.
+    uint8_t *v = state->v_register;
+    alu_8xy(0x7, &v[instr->x], v[instr->y], &v[0xF], 0);
 }
-void op_8xyE(chip8_state *state) { 
-    // Set Vx = Vx << 1 (shift left by 1)
-    // save MSB in VF
-    uint8_t vx_index = (state->opcode & 0x0F00u) >> 8;
 
-    state->v_register[0xF] = (state->v_register[vx_index] & 0x80) >> 7;
-    state->v_register[vx_index] <<= 1;
+void op_8xyE(chip8_state *state, decoded_instr const *instr) {
+    // Set Vx = Vx << 1, set VF = the bit shifted out.
+    uint8_t *v = state->v_register;
+    alu_8xy(0xE, &v[instr->x], v[instr->y], &v[0xF], 0);
 }
 
 // 00E_ grouped opcodes
-void op_00E0(chip8_state *state) { 
+void op_00E0(chip8_state *state, decoded_instr const *instr) { 
     // clear the display
     // set buffer to 0
+    (void)instr;
     memset(state->video, 0, sizeof(state->video));
+    state->video_dirty = ALL_ROWS_DIRTY;
 }
 
-void op_00EE(chip8_state *state) { 
+void op_00EE(chip8_state *state, decoded_instr const *instr) { 
     // return from a subroutine
     // decrement the stack pointer, and return the program counter
     // to where the stack pointer is pointing
+    (void)instr;
     state->stack_pointer--;
-    state->program_counter = state->stack[state->stack_pointer];
+    state->program_counter = state->stack[state->stack_pointer & STACK_MASK];
+    if (state->profile) {
+        profile_return(state->profile);
+    }
 }
 
 // Ex__ grouped opcodes
-void op_ExA1(chip8_state *state) {  
+void op_ExA1(chip8_state *state, decoded_instr const *instr) {  
     // Skip next instruction if key with the value of Vx is NOT pressed.
-    uint8_t vx_index = (state->opcode & 0x0F00) >> 8;
+    uint8_t vx_index = instr->x;
     
     uint8_t key = state->v_register[vx_index];
-    if (!state->keys[key]) {
+    if (!(state->keys >> (key & KEY_MASK) & 1)) {
         state->program_counter += 2;
     }
 }
 
-void op_Ex9E(chip8_state *state) { 
+void op_Ex9E(chip8_state *state, decoded_instr const *instr) { 
     // Skip next instruction if key with the value of Vx is pressed.
-    uint8_t vx_index = (state->opcode & 0x0F00) >> 8;
+    uint8_t vx_index = instr->x;
     
     uint8_t key = state->v_register[vx_index];
-    if (state->keys[key]) {
+    if (state->keys >> (key & KEY_MASK) & 1) {
         state->program_counter += 2;
     }
 }
 
 // Fx__ grouped opcodes
-void op_Fx07(chip8_state *state) {  
+void op_Fx07(chip8_state *state, decoded_instr const *instr) {  
     // Set Vx = delay timer value.
-    uint8_t vx_index = (state->opcode & 0x0F00) >> 8;
+    uint8_t vx_index = instr->x;
 
     state->v_register[vx_index] = state->delay_timer;
 }
 
-void op_Fx0A(chip8_state *state) {  
+void op_Fx0A(chip8_state *state, decoded_instr const *instr) {  
     // Wait for a key press, store the value of the key in Vx.
-    uint8_t vx_index = (state->opcode & 0x0F00u) >> 8;
+    uint8_t vx_index = instr->x;
 
-    // Iterate over all possible key values (0 to 15)
-    for (uint8_t i = 0; i < 16; ++i)
-    {
-        if (state->keys[i])
-        {
-            // Store the key value in Vx
-            state->v_register[vx_index] = i;
-            return; // Exit the function as soon as a key is detected
-        }
+    // Store the lowest key held in Vx
+    if (state->keys) {
+        state->v_register[vx_index] = __builtin_ctz(state->keys);
+        return;
     }
 
     // If no key is pressed, decrement the PC to wait for the next key press
     state->program_counter -= 2;
+    STATS_ADD(state, key_wait_spins, 1);
 }
 
-void op_Fx15(chip8_state *state) { 
+void op_Fx15(chip8_state *state, decoded_instr const *instr) { 
     // Set delay timer = Vx.
-    uint8_t vx_index = (state->opcode & 0x0F00u) >> 8;
+    uint8_t vx_index = instr->x;
 
     state->delay_timer = state->v_register[vx_index];
 }
 
-void op_Fx18(chip8_state *state) {  
+void op_Fx18(chip8_state *state, decoded_instr const *instr) {  
     // Set sound timer = Vx.
-    uint8_t vx_index = (state->opcode & 0x0F00u) >> 8;
+    uint8_t vx_index = instr->x;
 
     state->sound_timer = state->v_register[vx_index];
 }
 
-void op_Fx1E(chip8_state *state) { 
+void op_Fx1E(chip8_state *state, decoded_instr const *instr) { 
     // Set I = I + Vx.
-    uint8_t vx_index = (state->opcode & 0x0F00u) >> 8;
+    uint8_t vx_index = instr->x;
 
     state->index_register += state->v_register[vx_index];
 
 }
-void op_Fx29(chip8_state *state) { 
+void op_Fx29(chip8_state *state, decoded_instr const *instr) { 
     // Set I = location of sprite for digit Vx.
     // a font character is 5 bytes, and they are stored starting at 0x50.
-    uint8_t vx_index = (state->opcode & 0x0F00u) >> 8;
+    uint8_t vx_index = instr->x;
     uint8_t digit = state->v_register[vx_index];
 
     state->index_register = FONT_OFFSET + (5 * digit);
 }
 
-void op_Fx33(chip8_state *state) { 
+void op_Fx33(chip8_state *state, decoded_instr const *instr) { 
     // Store BCD representation of Vx in memory locations I, I+1, and I+2.
-    uint8_t vx_index = (state->opcode & 0x0F00u) >> 8;
+    uint8_t vx_index = instr->x;
     uint8_t val = state->v_register[vx_index];
     uint16_t index = state->index_register;
 
     // store it in "big endian", ones place in the highest index
     // integer division by 10 eliminates that place value
     // ones place
-    state->memory[index + 2] = val % 10;
+    store_byte(state, index + 2, val % 10);
     val /= 10;
 
     // tens place
-    state->memory[index + 1] = val % 10;
+    store_byte(state, index + 1, val % 10);
     val /= 10;
 
     // hundreds place
-    state->memory[index] = val % 10;
+    store_byte(state, index, val % 10);
+
+    // the write may have landed on code
+    invalidate_decoded(state, index, 3);
 }
 
-void op_Fx55(chip8_state *state) {  
+void op_Fx55(chip8_state *state, decoded_instr const *instr) {  
     // Store registers V0 through Vx in memory starting at location I.
-    uint8_t vx_index = (state->opcode & 0x0F00u) >> 8;
+    uint8_t vx_index = instr->x;
     uint16_t index = state->index_register;
 
     for (uint8_t i = 0; i <= vx_index; ++i) {
-        state->memory[index + i] = state->v_register[i];
+        store_byte(state, index + i, state->v_register[i]);
     }
+
+    // the write may have landed on code
+    invalidate_decoded(state, index, vx_index + 1);
 }
 
-void op_Fx65(chip8_state *state) { 
+void op_Fx65(chip8_state *state, decoded_instr const *instr) { 
     // Read registers V0 through Vx from memory starting at location I.
-    uint8_t vx_index = (state->opcode & 0x0F00u) >> 8;
+    uint8_t vx_index = instr->x;
     uint16_t index = state->index_register;
 
     for (uint8_t i = 0; i <= vx_index; ++i) {
-        state->v_register[i] = state->memory[index + i];
+        state->v_register[i] = state->memory[(index + i) & ADDRESS_MASK];
     }
 }
 
-void execute_opcode(chip8_state *state) {
-    // Fetch opcode (already stored in state->opcode)
+void op_unknown(chip8_state *state, decoded_instr const *instr) {
+    (void)state;
+    printf("Unknown opcode: 0x%X\n", instr->opcode);
+}
 
-    // Decode and execute opcode
-    uint16_t opcode = state->opcode;
+// the handler for each op_index that stands for a single instruction
+static const op_handler HANDLERS[NUM_OPS] = {
+    [OP_UNKNOWN] = op_unknown, [OP_00E0] = op_00E0, [OP_00EE] = op_00EE,
+    [OP_1nnn] = op_1nnn, [OP_2nnn] = op_2nnn, [OP_3xkk] = op_3xkk,
+    [OP_4xkk] = op_4xkk, [OP_5xy0] = op_5xy0, [OP_6xkk] = op_6xkk,
+    [OP_7xkk] = op_7xkk, [OP_8xy0] = op_8xy0, [OP_8xy1] = op_8xy1,
+    [OP_8xy2] = op_8xy2, [OP_8xy3] = op_8xy3, [OP_8xy4] = op_8xy4,
+    [OP_8xy5] = op_8xy5, [OP_8xy6] = op_8xy6, [OP_8xy7] = op_8xy7,
+    [OP_8xyE] = op_8xyE, [OP_9xy0] = op_9xy0, [OP_Annn] = op_Annn,
+    [OP_Bnnn] = op_Bnnn, [OP_Cxkk] = op_Cxkk, [OP_Dxyn] = op_Dxyn,
+    [OP_Ex9E] = op_Ex9E, [OP_ExA1] = op_ExA1, [OP_Fx07] = op_Fx07,
+    [OP_Fx0A] = op_Fx0A, [OP_Fx15] = op_Fx15, [OP_Fx18] = op_Fx18,
+    [OP_Fx1E] = op_Fx1E, [OP_Fx29] = op_Fx29, [OP_Fx33] = op_Fx33,
+    [OP_Fx55] = op_Fx55, [OP_Fx65] = op_Fx65,
+};
+
+// pick the handler for an opcode, the old execute_opcode switch
+static op_index decode_op(uint16_t opcode) {
     uint16_t first_nibble = (opcode & 0xF000u) >> 12;
 
     switch (first_nibble) {
@@ -397,150 +411,354 @@ void execute_opcode(chip8_state *state) {
             // Special handling for 0x00E0 and 0x00EE
             switch (opcode & 0x00FFu) {
                 case 0x00E0:
-                    op_00E0(state);
-                    break;
+                    return OP_00E0;
                 case 0x00EE:
-                    op_00EE(state);
-                    break;
+                    return OP_00EE;
                 default:
-                    printf("Unknown opcode: 0x%X\n", opcode);
-                    break;
+                    return OP_UNKNOWN;
             }
-            break;
         case 0x1:
-            op_1nnn(state);
-            break;
+            return OP_1nnn;
         case 0x2:
-            op_2nnn(state);
-            break;
+            return OP_2nnn;
         case 0x3:
-            op_3xkk(state);
-            break;
+            return OP_3xkk;
         case 0x4:
-            op_4xkk(state);
-            break;
+            return OP_4xkk;
         case 0x5:
-            op_5xy0(state);
-            break;
+            return OP_5xy0;
         case 0x6:
-            op_6xkk(state);
-            break;
+            return OP_6xkk;
         case 0x7:
-            op_7xkk(state);
-            break;
+            return OP_7xkk;
         case 0x8:
             switch (opcode & 0x000Fu) {
                 case 0x0:
-                    op_8xy0(state);
-                    break;
+                    return OP_8xy0;
                 case 0x1:
-                    op_8xy1(state);
-                    break;
+                    return OP_8xy1;
                 case 0x2:
-                    op_8xy2(state);
-                    break;
+                    return OP_8xy2;
                 case 0x3:
-                    op_8xy3(state);
-                    break;
+                    return OP_8xy3;
                 case 0x4:
-                    op_8xy4(state);
-                    break;
+                    return OP_8xy4;
                 case 0x5:
-                    op_8xy5(state);
-                    break;
+                    return OP_8xy5;
                 case 0x6:
-                    op_8xy6(state);
-                    break;
+                    return OP_8xy6;
                 case 0x7:
-                    op_8xy7(state);
-                    break;
+                    return OP_8xy7;
                 case 0xE:
-                    op_8xyE(state);
-                    break;
+                    return OP_8xyE;
                 default:
-                    printf("Unknown opcode: 0x%X\n", opcode);
-                    break;
+                    return OP_UNKNOWN;
             }
-            break;
         case 0x9:
-            op_9xy0(state);
-            break;
+            return OP_9xy0;
         case 0xA:
-            op_Annn(state);
-            break;
+            return OP_Annn;
         case 0xB:
-            op_Bnnn(state);
-            break;
+            return OP_Bnnn;
         case 0xC:
-            op_Cxkk(state);
-            break;
+            return OP_Cxkk;
         case 0xD:
-            op_Dxyn(state);
-            break;
+            return OP_Dxyn;
         case 0xE:
             switch (opcode & 0x00FFu) {
                 case 0x9E:
-                    op_Ex9E(state);
-                    break;
+                    return OP_Ex9E;
                 case 0xA1:
-                    op_ExA1(state);
-                    break;
+                    return OP_ExA1;
                 default:
-                    printf("Unknown opcode: 0x%X\n", opcode);
-                    break;
+                    return OP_UNKNOWN;
             }
-            break;
         case 0xF:
             switch (opcode & 0x00FFu) {
                 case 0x07:
-                    op_Fx07(state);
-                    break;
+                    return OP_Fx07;
                 case 0x0A:
-                    op_Fx0A(state);
-                    break;
+                    return OP_Fx0A;
                 case 0x15:
-                    op_Fx15(state);
-                    break;
+                    return OP_Fx15;
                 case 0x18:
-                    op_Fx18(state);
-                    break;
+                    return OP_Fx18;
                 case 0x1E:
-                    op_Fx1E(state);
-                    break;
+                    return OP_Fx1E;
                 case 0x29:
-                    op_Fx29(state);
-                    break;
+                    return OP_Fx29;
                 case 0x33:
-                    op_Fx33(state);
-                    break;
+                    return OP_Fx33;
                 case 0x55:
-                    op_Fx55(state);
-                    break;
+                    return OP_Fx55;
                 case 0x65:
-                    op_Fx65(state);
-                    break;
+                    return OP_Fx65;
                 default:
-                    printf("Unknown opcode: 0x%X\n", opcode);
-                    break;
+                    return OP_UNKNOWN;
+            }
+        default:
+            return OP_UNKNOWN;
+    }
+}
+
+
+decoded_instr decode_opcode(uint16_t opcode) {
+    decoded_instr instr;
+
+    instr.op = decode_op(opcode);
+    instr.handler = HANDLERS[instr.op];
+    instr.opcode = opcode;
+    instr.nnn = opcode & 0x0FFFu;
+    instr.x = (opcode & 0x0F00u) >> 8;
+    instr.y = (opcode & 0x00F0u) >> 4;
+    instr.kk = opcode & 0x00FFu;
+    instr.n = opcode & 0x000Fu;
+    return instr;
+}
+
+void execute_opcode(chip8_state *state) {
+    // Decode and execute the opcode already stored in state->opcode,
+    // bypassing the decode cache
+    decoded_instr instr = decode_opcode(state->opcode);
+    STATS_COUNT_UNCACHED(state, instr.op, state->program_counter - 2);
+    instr.handler(state, &instr);
+}
+
+void initialise_opcode_tables(chip8_state *state) {
+    // a NULL handler marks an address that hasn't been decoded yet
+    STATS_RETIRE(state, 0, MEMORY_SPACE);
+    memset(state->decode_cache, 0, sizeof(state->decode_cache));
+}
+
+void invalidate_decoded(chip8_state *state, uint16_t address, uint16_t length) {
+    // The instruction starting one byte before address also covers it, and
+    // a superinstruction covers up to SUPER_MAX_LENGTH instructions from
+    // where it starts
+    uint16_t before = 2 * SUPER_MAX_LENGTH - 1;
+    STATS_RETIRE(state, address - before, length + before);
+    for (uint32_t i = 0; i < length + before; ++i) {
+        state->decode_cache[(address - before + i) & ADDRESS_MASK].handler = NULL;
+    }
+
+    // widen the span of stores, all of memory if this one wrapped around
+    uint32_t end = (uint32_t)address + length;
+    if (end > MEMORY_SPACE) {
+        address = 0;
+        end = MEMORY_SPACE;
+    }
+    if (state->stored_high == 0) {
+        state->stored_low = address;
+        state->stored_high = end;
+    } else {
+        state->stored_low = address < state->stored_low ? address : state->stored_low;
+        state->stored_high = end > state->stored_high ? end : state->stored_high;
+    }
+}
+
+static inline uint16_t fetch(chip8_state const *state, uint16_t address) {
+    return (state->memory[address & ADDRESS_MASK] << 8) | state->memory[(address + 1) & ADDRESS_MASK];
+}
+
+// Superinstructions: short runs of instructions executed as one, with one
+// dispatch instead of two or three. The runs are the commonest in traces of
+// tetris.ch8 playing its golden input, where Dxyn+7xkk and 3xkk+1nnn are
+// about 13% and 12% of all pairs and 7xkk+3xkk+1nnn 11% of triples, plus
+// Annn+Dxyn, 6xkk+6xkk and Fx07+3xkk, which lead most sprite draws, setup
+// code and timer checks. A Fx07+3xkk+1nnn loop polling the timer is left
+// alone, emu_skip_idle skips those whole.
+//
+// Sets instr->op to the superinstruction starting at pc, if any, and returns
+// the number of instructions it stands for, 1 if none. Stats builds count
+// every instruction at its own address, so they never fuse.
+static int fuse(chip8_state const *state, uint16_t pc, decoded_instr *instr) {
+#ifdef CHIP8_STATS
+    (void)state;
+    (void)pc;
+    (void)instr;
+    return 1;
+#else
+    // runs don't wrap around the end of memory
+    if (pc > MEMORY_SPACE - 4) {
+        return 1;
+    }
+    uint16_t next = fetch(state, pc + 2);
+    uint16_t after = pc <= MEMORY_SPACE - 6 ? fetch(state, pc + 4) : 0;
+
+    switch (instr->op) {
+        case OP_6xkk:
+            if ((next & 0xF000u) == 0x6000u) {
+                instr->op = SUPER_6xkk_6xkk;
+                return 2;
+            }
+            break;
+        case OP_Annn:
+            if ((next & 0xF000u) == 0xD000u) {
+                instr->op = SUPER_Annn_Dxyn;
+                return 2;
+            }
+            break;
+        case OP_Dxyn:
+            if ((next & 0xF000u) == 0x7000u) {
+                instr->op = SUPER_Dxyn_7xkk;
+                return 2;
+            }
+            break;
+        case OP_3xkk:
+            if ((next & 0xF000u) == 0x1000u) {
+                instr->op = SUPER_3xkk_1nnn;
+                return 2;
+            }
+            break;
+        case OP_7xkk:
+            if ((next & 0xF000u) == 0x3000u && (after & 0xF000u) == 0x1000u) {
+                instr->op = SUPER_7xkk_3xkk_1nnn;
+                return 3;
+            }
+            break;
+        case OP_Fx07:
+            if ((next & 0xF000u) == 0x3000u && after != (0x1000u | pc)) {
+                instr->op = SUPER_Fx07_3xkk;
+                return 2;
             }
             break;
         default:
-            printf("Unknown opcode: 0x%X\n", opcode);
             break;
     }
+    return 1;
+#endif
 }
 
+// Decode the instruction at pc into the cache, kept out of line so the hit
+// path stays small. A superinstruction reads the operands of the
+// instructions after its first from their own entries, so those are decoded
+// too, along with any run they start in turn.
+static __attribute__((noinline)) void decode_into_cache(chip8_state *state, uint16_t pc) {
+    uint16_t end = pc;
+    for (uint16_t address = pc; address <= end; address += 2) {
+        decoded_instr *instr = &state->decode_cache[address];
+        if (instr->handler != NULL) {
+            continue;
+        }
+        *instr = decode_opcode(fetch(state, address));
+        uint16_t last = address + 2 * (fuse(state, address, instr) - 1);
+        if (last > end) {
+            end = last;
+        }
+    }
+}
 
-void emu_cycle(chip8_state *state) {
-    // Fetch opcode
-    state->opcode = (state->memory[state->program_counter] << 8) | state->memory[state->program_counter + 1];
+// emu_cycle's body, forced inline so emu_run's loop doesn't pay for a call
+// per instruction. Returns the opcode it executed.
+static inline __attribute__((always_inline)) uint16_t cycle(chip8_state *state) {
+    // Look up the predecoded instruction, decoding on first visit
+    uint16_t pc = state->program_counter & ADDRESS_MASK;
+    decoded_instr *instr = &state->decode_cache[pc];
+    if (instr->handler == NULL) {
+        decode_into_cache(state, pc);
+    }
+    uint16_t opcode = instr->opcode;
+    state->opcode = opcode;
+    STATS_COUNT_INSTR(state, pc);
 
     // Increment the PC before executing
     state->program_counter += 2;
 
-    // Decode and execute the fetched opcode
-    execute_opcode(state);
+    // Execute the decoded opcode
+    instr->handler(state, instr);
+    return opcode;
+}
+
+void emu_cycle(chip8_state *state) {
+    cycle(state);
+}
+
+// the cached decode at address, decoding it if needed
+static decoded_instr const *decoded_at(chip8_state *state, uint16_t address) {
+    address &= ADDRESS_MASK;
+    if (state->decode_cache[address].handler == NULL) {
+        decode_into_cache(state, address);
+    }
+    return &state->decode_cache[address];
+}
+
+// Fx0A found no key down and rewound the PC. Keys only change between runs,
+// so it will do the same every remaining cycle.
+static uint64_t skip_key_wait(chip8_state *state, uint64_t cycles) {
+    if (state->keys) {
+        return 0;
+    }
+
+    STATS_ADD(state, pending[state->program_counter & ADDRESS_MASK], cycles);
+    STATS_ADD(state, key_wait_spins, cycles);
+    return cycles;
+}
+
+// Fx07 just ran at the top of a loop polling the delay timer:
+//
+//     loop: Fx07        ; Vx = DT
+//           3xkk / 4xkk ; leave the loop if Vx == kk / Vx != kk
+//           1nnn        ; jump to loop
+//
+// DT only changes between frames, so if this pass doesn't leave the loop no
+// pass before the end of the run will. The loop is skipped to where those
+// cycles would have left it: the same three instructions round and round,
+// with Vx holding DT throughout.
+static uint64_t skip_timer_poll(chip8_state *state, uint64_t cycles) {
+    uint16_t loop = (state->program_counter - 2) & ADDRESS_MASK;
+    if (loop > MEMORY_SPACE - 6) {
+        return 0;
+    }
+
+    uint8_t x = (state->opcode & 0x0F00u) >> 8;
+    decoded_instr const *test = decoded_at(state, loop + 2);
+    decoded_instr const *jump = decoded_at(state, loop + 4);
+    if (jump->handler != op_1nnn || jump->nnn != loop || test->x != x) {
+        return 0;
+    }
+    if (test->handler == op_3xkk) {
+        if (state->delay_timer == test->kk) {
+            return 0;
+        }
+    } else if (test->handler == op_4xkk) {
+        if (state->delay_timer != test->kk) {
+            return 0;
+        }
+    } else {
+        return 0;
+    }
 
+    // the next instruction is the test, at position 1 of the 3
+    uint16_t opcodes[3] = { state->opcode, test->opcode, jump->opcode };
+    state->program_counter = loop + 2 * ((1 + cycles) % 3);
+    state->opcode = opcodes[cycles % 3];
+
+#ifdef CHIP8_STATS
+    if (state->stats) {
+        uint64_t full = cycles / 3, extra = cycles % 3;
+        state->stats->pending[loop + 2] += full + (extra >= 1);
+        state->stats->pending[loop + 4] += full + (extra >= 2);
+        state->stats->pending[loop] += full;
+    }
+#endif
+    return cycles;
+}
+
+uint64_t emu_skip_idle(chip8_state *state, uint64_t cycles) {
+    if (cycles == 0) {
+        return 0;
+    }
+
+    switch (state->opcode & 0xF0FFu) {
+        case 0xF00A:
+            return skip_key_wait(state, cycles);
+        case 0xF007:
+            return skip_timer_poll(state, cycles);
+        default:
+            return 0;
+    }
+}
+
+void emu_tick_timers(chip8_state *state) {
     // Decrement the delay timer if it's been set
     if (state->delay_timer > 0) {
         --state->delay_timer;
@@ -551,3 +769,269 @@ void emu_cycle(chip8_state *state) {
         --state->sound_timer;
     }
 }
+
+int emu_waiting_for_key(chip8_state const *state) {
+    uint16_t pc = state->program_counter & ADDRESS_MASK;
+    if ((state->memory[pc] & 0xF0) != 0xF0 || state->memory[(pc + 1) & ADDRESS_MASK] != 0x0A) {
+        return 0;
+    }
+    return state->keys == 0;
+}
+
+void emu_idle_frames(chip8_state *state, uint64_t frames, uint64_t cycles_per_frame) {
+    // every cycle re-runs the Fx0A, so all that moves is the timers
+    state->opcode = (state->memory[state->program_counter & ADDRESS_MASK] << 8)
+        | state->memory[(state->program_counter + 1) & ADDRESS_MASK];
+    state->delay_timer = frames < state->delay_timer ? state->delay_timer - frames : 0;
+    state->sound_timer = frames < state->sound_timer ? state->sound_timer - frames : 0;
+
+    STATS_ADD(state, pending[state->program_counter & ADDRESS_MASK], frames * cycles_per_frame);
+    STATS_ADD(state, key_wait_spins, frames * cycles_per_frame);
+    (void)cycles_per_frame;
+}
+
+// Computed-goto dispatch needs GCC's labels-as-values. Each handler's label
+// ends in its own copy of the dispatch, so the host predicts each jump from
+// the instruction before it rather than from one shared indirect call. Stats
+// builds keep the plain loop, which counts every instruction.
+#if defined(__GNUC__) && !defined(CHIP8_STATS)
+
+uint64_t emu_run(chip8_state *state, uint64_t cycles) {
+    static void *const dispatch[NUM_OPS] = {
+        [OP_UNKNOWN] = &&do_unknown, [OP_00E0] = &&do_00E0, [OP_00EE] = &&do_00EE,
+        [OP_1nnn] = &&do_1nnn, [OP_2nnn] = &&do_2nnn, [OP_3xkk] = &&do_3xkk,
+        [OP_4xkk] = &&do_4xkk, [OP_5xy0] = &&do_5xy0, [OP_6xkk] = &&do_6xkk,
+        [OP_7xkk] = &&do_7xkk, [OP_8xy0] = &&do_8xy0, [OP_8xy1] = &&do_8xy1,
+        [OP_8xy2] = &&do_8xy2, [OP_8xy3] = &&do_8xy3, [OP_8xy4] = &&do_8xy4,
+        [OP_8xy5] = &&do_8xy5, [OP_8xy6] = &&do_8xy6, [OP_8xy7] = &&do_8xy7,
+        [OP_8xyE] = &&do_8xyE, [OP_9xy0] = &&do_9xy0, [OP_Annn] = &&do_Annn,
+        [OP_Bnnn] = &&do_Bnnn, [OP_Cxkk] = &&do_Cxkk, [OP_Dxyn] = &&do_Dxyn,
+        [OP_Ex9E] = &&do_Ex9E, [OP_ExA1] = &&do_ExA1, [OP_Fx07] = &&do_Fx07,
+        [OP_Fx0A] = &&do_Fx0A, [OP_Fx15] = &&do_Fx15, [OP_Fx18] = &&do_Fx18,
+        [OP_Fx1E] = &&do_Fx1E, [OP_Fx29] = &&do_Fx29, [OP_Fx33] = &&do_Fx33,
+        [OP_Fx55] = &&do_Fx55, [OP_Fx65] = &&do_Fx65,
+        [SUPER_6xkk_6xkk] = &&do_6xkk_6xkk, [SUPER_Annn_Dxyn] = &&do_Annn_Dxyn,
+        [SUPER_Dxyn_7xkk] = &&do_Dxyn_7xkk, [SUPER_3xkk_1nnn] = &&do_3xkk_1nnn,
+        [SUPER_7xkk_3xkk_1nnn] = &&do_7xkk_3xkk_1nnn, [SUPER_Fx07_3xkk] = &&do_Fx07_3xkk,
+    };
+    uint64_t done = 0;
+    decoded_instr *instr;
+
+// fetch the next instruction, decoding on first visit, and jump to it
+#define DISPATCH() do { \
+        if (done >= cycles) { \
+            return cycles; \
+        } \
+        uint16_t pc = state->program_counter & ADDRESS_MASK; \
+        instr = &state->decode_cache[pc]; \
+        if (instr->handler == NULL) { \
+            decode_into_cache(state, pc); \
+        } \
+        goto *dispatch[instr->op]; \
+    } while (0)
+
+// one instruction, exactly as cycle() runs it
+#define SINGLE(name) \
+    do_##name: \
+        state->opcode = instr->opcode; \
+        state->program_counter += 2; \
+        op_##name(state, instr); \
+        ++done; \
+        DISPATCH();
+
+// a superinstruction standing for length instructions. With fewer than that
+// left in the run, just the first is executed.
+#define SUPER(length) do { \
+        if (cycles - done < (length)) { \
+            goto single; \
+        } \
+    } while (0)
+
+// as SINGLE, but a profiled run ends after it for the caller to charge the
+// cycles so far to the subroutine that ran them
+#define CALL_OR_RETURN(name) \
+    do_##name: \
+        state->opcode = instr->opcode; \
+        state->program_counter += 2; \
+        op_##name(state, instr); \
+        ++done; \
+        if (state->profile) { \
+            return done; \
+        } \
+        DISPATCH();
+
+    DISPATCH();
+
+    SINGLE(unknown)
+    SINGLE(00E0)
+    CALL_OR_RETURN(00EE)
+    SINGLE(1nnn)
+    CALL_OR_RETURN(2nnn)
+    SINGLE(3xkk)
+    SINGLE(4xkk)
+    SINGLE(5xy0)
+    SINGLE(6xkk)
+    SINGLE(7xkk)
+    SINGLE(8xy0)
+    SINGLE(8xy1)
+    SINGLE(8xy2)
+    SINGLE(8xy3)
+    SINGLE(8xy4)
+    SINGLE(8xy5)
+    SINGLE(8xy6)
+    SINGLE(8xy7)
+    SINGLE(8xyE)
+    SINGLE(9xy0)
+    SINGLE(Annn)
+    SINGLE(Bnnn)
+    SINGLE(Cxkk)
+    SINGLE(Dxyn)
+    SINGLE(Ex9E)
+    SINGLE(ExA1)
+    SINGLE(Fx15)
+    SINGLE(Fx18)
+    SINGLE(Fx1E)
+    SINGLE(Fx29)
+    SINGLE(Fx33)
+    SINGLE(Fx55)
+    SINGLE(Fx65)
+
+    // the two that can start idle loops
+do_Fx07:
+do_Fx0A:
+single:
+    state->opcode = instr->opcode;
+    state->program_counter += 2;
+    instr->handler(state, instr);
+    ++done;
+    if ((state->opcode & 0xF0F0u) == 0xF000u) {
+        done += emu_skip_idle(state, cycles - done);
+    }
+    DISPATCH();
+
+do_6xkk_6xkk:
+    SUPER(2);
+    state->v_register[instr[0].x] = instr[0].kk;
+    state->v_register[instr[2].x] = instr[2].kk;
+    state->opcode = instr[2].opcode;
+    state->program_counter += 4;
+    done += 2;
+    DISPATCH();
+
+do_Annn_Dxyn:
+    SUPER(2);
+    state->index_register = instr[0].nnn;
+    state->opcode = instr[2].opcode;
+    state->program_counter += 4;
+    op_Dxyn(state, &instr[2]);
+    done += 2;
+    DISPATCH();
+
+do_Dxyn_7xkk:
+    SUPER(2);
+    state->opcode = instr[2].opcode;
+    state->program_counter += 4;
+    op_Dxyn(state, &instr[0]);
+    state->v_register[instr[2].x] += instr[2].kk;
+    done += 2;
+    DISPATCH();
+
+do_3xkk_1nnn:
+    SUPER(2);
+    if (state->v_register[instr[0].x] == instr[0].kk) {
+        // skips the jump
+        state->opcode = instr[0].opcode;
+        state->program_counter += 4;
+        done += 1;
+    } else {
+        state->opcode = instr[2].opcode;
+        state->program_counter = instr[2].nnn;
+        done += 2;
+    }
+    DISPATCH();
+
+do_7xkk_3xkk_1nnn:
+    SUPER(3);
+    state->v_register[instr[0].x] += instr[0].kk;
+    if (state->v_register[instr[2].x] == instr[2].kk) {
+        state->opcode = instr[2].opcode;
+        state->program_counter += 6;
+        done += 2;
+    } else {
+        state->opcode = instr[4].opcode;
+        state->program_counter = instr[4].nnn;
+        done += 3;
+    }
+    DISPATCH();
+
+do_Fx07_3xkk:
+    SUPER(2);
+    state->v_register[instr[0].x] = state->delay_timer;
+    state->opcode = instr[2].opcode;
+    state->program_counter += state->v_register[instr[2].x] == instr[2].kk ? 6 : 4;
+    done += 2;
+    DISPATCH();
+
+#undef DISPATCH
+#undef SINGLE
+#undef CALL_OR_RETURN
+#undef SUPER
+}
+
+#else
+
+uint64_t emu_run(chip8_state *state, uint64_t cycles) {
+    uint64_t done = 0;
+    while (done < cycles) {
+        uint16_t opcode = cycle(state);
+        ++done;
+
+        // only Fx07 and Fx0A start idle loops, and they share this pattern
+        if ((opcode & 0xF0F0u) == 0xF000u) {
+            done += emu_skip_idle(state, cycles - done);
+        }
+        if (state->profile && ((opcode & 0xF000u) == 0x2000u || opcode == 0x00EEu)) {
+            return done;
+        }
+    }
+    return cycles;
+}
+
+#endif
+
+uint64_t emu_state_hash(chip8_state const *state) {
+    // the registers are small enough to fold in whole each time
+    uint64_t words[STATE_HASH_WORDS] = { 0 };
+    memcpy(words, state->v_register, NUM_V_REG);
+    memcpy(&words[2], state->stack, sizeof(state->stack));
+    words[6] = state->index_register
+        | (uint64_t)state->program_counter << 16
+        | (uint64_t)state->stack_pointer << 32
+        | (uint64_t)state->delay_timer << 40
+        | (uint64_t)state->sound_timer << 48;
+    words[7] = state->rng_state ^ ((uint64_t)state->keys << 48);
+    return emu_fold_state_hash(state->memory_hash ^ hash_video(state), words);
+}
+
+uint64_t emu_fold_state_hash(uint64_t hash, uint64_t const *words) {
+    for (int i = 0; i < STATE_HASH_WORDS; ++i) {
+        hash = (hash ^ words[i]) * 0xBF58476D1CE4E5B9ull;
+        hash ^= hash >> 31;
+    }
+    return hash;
+}
+
+uint64_t hash_video(chip8_state const *state) {
+    return hash_video_rows(state->video);
+}
+
+uint64_t hash_video_rows(uint64_t const *video) {
+    // a row at a time: fold each 64-bit row in with a multiply and an
+    // xorshift so every bit of it reaches every bit of the hash
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (int row = 0; row < VIDEO_ROWS; ++row) {
+        hash = (hash ^ video[row]) * 0xBF58476D1CE4E5B9ull;
+        hash ^= hash >> 31;
+    }
+    return hash;
+}
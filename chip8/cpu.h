@@ -4,13 +4,82 @@
 #include "loadROM.h"
 #include "font.h"
 
-// Initialize opcode tables
+// Initialize opcode tables, i.e. empty the state's decode cache
 void initialise_opcode_tables(chip8_state *state);
 
-// Fetch, decode, and execute an opcode
+// Decode an opcode into its handler and operands
+decoded_instr decode_opcode(uint16_t opcode);
+
+// Decode and execute the opcode in state->opcode, without the decode cache
 void execute_opcode(chip8_state *state);
 
-// initialise the actual chip8 system
-void initialise_state(chip8_state *state);
+// Drop cached decodes covering memory[address, address + length), and add
+// it to the span in stored_low/stored_high
+void invalidate_decoded(chip8_state *state, uint16_t address, uint16_t length);
+
+// the xorshift64* state Cxkk starts from for a seed
+uint64_t rng_seed(uint64_t seed);
+
+// initialise the actual chip8 system, seeding its random number generator
+void initialise_state(chip8_state *state, uint64_t seed);
+
+// Fetch, decode and execute one instruction. Timers are left alone.
+void emu_cycle(chip8_state *state);
+
+// count the timers down by one, once per 60 Hz frame
+void emu_tick_timers(chip8_state *state);
+
+// Run emu_cycle cycles times, returns the number of instructions executed.
+// Idle loops (see emu_skip_idle) are skipped rather than executed, with the
+// same result. On a profiled state the run also ends just after a 2nnn or
+// 00EE, with fewer executed, so the caller can charge them (see profile.h).
+uint64_t emu_run(chip8_state *state, uint64_t cycles);
+
+// Call right after an instruction. If it left the machine waiting for a key
+// in Fx0A, or polling the delay timer in a tight Fx07 loop, nothing can
+// change until the keys or timers do, which is never within one run. The
+// state is advanced exactly as if up to cycles more instructions had run,
+// and the number skipped is returned; 0 if the machine isn't idle.
+uint64_t emu_skip_idle(chip8_state *state, uint64_t cycles);
+
+// true if the machine is parked in Fx0A with no key down
+int emu_waiting_for_key(chip8_state const *state);
+
+// Advance a machine parked in Fx0A (emu_waiting_for_key) by whole frames,
+// exactly as running frames * cycles_per_frame cycles and ticking the timers
+// after each frame would, as long as no key changes in between
+void emu_idle_frames(chip8_state *state, uint64_t frames, uint64_t cycles_per_frame);
+
+// Recompute memory_hash from scratch, after memory was written other than
+// by an instruction, e.g. loading a ROM or a state
+void emu_rehash_memory(chip8_state *state);
+
+// One byte's share of memory_hash. The hash is the sum of these over all
+// addresses, so a store only swaps the old byte's term for the new one.
+static inline uint64_t emu_memory_term(uint16_t address, uint8_t value) {
+    uint64_t x = (((uint64_t)address << 8) | value) + 1;
+    x *= 0x9E3779B97F4A7C15ull;
+    x ^= x >> 32;
+    x *= 0xBF58476D1CE4E5B9ull;
+    return x ^ (x >> 29);
+}
+
+// 64-bit hash of everything that decides what the machine does next:
+// registers, stack, timers, keys, random state, memory and the screen. Two
+// states with the same hash behave the same from then on. The memory part
+// is kept up to date store by store, so this costs about as much as
+// hash_video and can be taken every frame.
+uint64_t emu_state_hash(chip8_state const *state);
+
+// emu_state_hash's last step, for machines kept other than in a chip8_state
+// (batch lanes): fold the registers, packed into words as emu_state_hash
+// packs them, into memory_hash ^ the screen's hash
+#define STATE_HASH_WORDS 8
+uint64_t emu_fold_state_hash(uint64_t hash, uint64_t const *words);
+
+// 64-bit hash of the framebuffer, for comparing runs. Cheap enough to take
+// every frame
+uint64_t hash_video(chip8_state const *state);
 
-void emu_cycle(chip8_state *state);
\ No newline at end of file
+// hash_video of a screen held elsewhere
+uint64_t hash_video_rows(uint64_t const *video);
\ No newline at end of file
@@ -3,4 +3,11 @@
 
 #define FONT_SIZE 80
 
-void load_font(chip8_state *state);
\ No newline at end of file
+// SUPER-CHIP's 8x10 digits, straight after the small ones
+#define BIG_FONT_OFFSET (FONT_OFFSET + FONT_SIZE)
+#define BIG_FONT_SIZE 160
+
+void load_font(chip8_state *state);
+
+// both fonts, into a memory image of any size
+void load_fonts(uint8_t *memory);
\ No newline at end of file
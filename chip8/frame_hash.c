@@ -0,0 +1,165 @@
+#include "frame_hash.h"
+#include "cpu.h"
+#include <stdlib.h>
+#include <string.h>
+
+int frame_hash_open_write(frame_hash_stream *stream, char const *path, int changes_only, uint16_t cycles_per_frame, uint64_t seed) {
+    memset(stream, 0, sizeof(*stream));
+    stream->changes_only = changes_only;
+    stream->cycles_per_frame = cycles_per_frame;
+    stream->seed = seed;
+
+    stream->file = fopen(path, "w");
+    if (stream->file == NULL) {
+        fprintf(stderr, "Failed to open frame hash file: %s\n", path);
+        return -1;
+    }
+    fprintf(stream->file, "C8FH %d %s %u %llu\n", FRAME_HASH_VERSION, changes_only ? "changes" : "all",
+            cycles_per_frame, (unsigned long long)seed);
+    return 0;
+}
+
+int frame_hash_open_compare(frame_hash_stream *stream, char const *path) {
+    memset(stream, 0, sizeof(*stream));
+    stream->comparing = 1;
+
+    FILE *fptr = fopen(path, "r");
+    if (fptr == NULL) {
+        fprintf(stderr, "Failed to open frame hash file: %s\n", path);
+        return -1;
+    }
+
+    int version;
+    char mode[16];
+    unsigned int cycles_per_frame;
+    unsigned long long seed;
+    if (fscanf(fptr, "C8FH %d %15s %u %llu", &version, mode, &cycles_per_frame, &seed) != 4
+        || version != FRAME_HASH_VERSION || (strcmp(mode, "all") != 0 && strcmp(mode, "changes") != 0)) {
+        fprintf(stderr, "%s: not a frame hash stream\n", path);
+        fclose(fptr);
+        return -1;
+    }
+    stream->changes_only = strcmp(mode, "changes") == 0;
+    stream->cycles_per_frame = cycles_per_frame;
+    stream->seed = seed;
+
+    size_t capacity = 0;
+    char line[128];
+    int ended = 0;
+    while (!ended && fgets(line, sizeof(line), fptr)) {
+        unsigned long long frame, cycle, hash;
+        if (line[0] == '\n') {
+            continue;
+        }
+        if (sscanf(line, "end %llu %llu", &frame, &cycle) == 2) {
+            stream->end_frame = frame;
+            stream->end_cycle = cycle;
+            ended = 1;
+            continue;
+        }
+        if (sscanf(line, "%llu %llu %llx", &frame, &cycle, &hash) != 3) {
+            fprintf(stderr, "%s: bad line: %s", path, line);
+            break;
+        }
+
+        if (stream->count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            frame_hash_entry *grown = realloc(stream->entries, capacity * sizeof(frame_hash_entry));
+            if (grown == NULL) {
+                break;
+            }
+            stream->entries = grown;
+        }
+        frame_hash_entry *entry = &stream->entries[stream->count++];
+        entry->frame = frame;
+        entry->cycle = cycle;
+        entry->hash = hash;
+    }
+    fclose(fptr);
+
+    if (!ended) {
+        fprintf(stderr, "%s: frame hash stream has no end line\n", path);
+        free(stream->entries);
+        stream->entries = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+// Both machines' frame_hash_step, given whether the frame drew and the
+// screen's hash
+static int step(frame_hash_stream *stream, int dirty, uint64_t hash, uint64_t frame, uint64_t cycle) {
+    int emit = !stream->changes_only || dirty;
+
+    if (!stream->comparing) {
+        if (emit) {
+            fprintf(stream->file, "%llu %llu %016llx\n", (unsigned long long)frame,
+                    (unsigned long long)cycle, (unsigned long long)hash);
+        }
+        return 0;
+    }
+
+    frame_hash_entry const *expected = stream->next < stream->count ? &stream->entries[stream->next] : NULL;
+    int expect = expected != NULL && expected->frame == frame;
+    if (!emit && !expect) {
+        return 0;
+    }
+
+    if (emit && expect) {
+        ++stream->next;
+        if (hash == expected->hash && cycle == expected->cycle) {
+            return 0;
+        }
+        fprintf(stderr, "diverged at frame %llu (cycle %llu): hash %016llx, golden stream has %016llx at cycle %llu\n",
+                (unsigned long long)frame, (unsigned long long)cycle, (unsigned long long)hash,
+                (unsigned long long)expected->hash, (unsigned long long)expected->cycle);
+    } else if (emit) {
+        fprintf(stderr, "diverged at frame %llu (cycle %llu): screen changed, golden stream says it didn't\n",
+                (unsigned long long)frame, (unsigned long long)cycle);
+    } else {
+        fprintf(stderr, "diverged at frame %llu (cycle %llu): screen didn't change, golden stream says it did\n",
+                (unsigned long long)frame, (unsigned long long)cycle);
+    }
+    stream->diverged = 1;
+    return -1;
+}
+
+int frame_hash_step(frame_hash_stream *stream, chip8_state *state, uint64_t frame, uint64_t cycle) {
+    int dirty = state->video_dirty != 0;
+    state->video_dirty = 0;
+    return step(stream, dirty, hash_video(state), frame, cycle);
+}
+
+int frame_hash_step_xchip(frame_hash_stream *stream, xchip_state *state, uint64_t frame, uint64_t cycle) {
+    int dirty = state->video_dirty != 0;
+    state->video_dirty = 0;
+    return step(stream, dirty, xchip_hash_video(state), frame, cycle);
+}
+
+int frame_hash_close(frame_hash_stream *stream, uint64_t frames, uint64_t cycles) {
+    if (!stream->comparing) {
+        fprintf(stream->file, "end %llu %llu\n", (unsigned long long)frames, (unsigned long long)cycles);
+        int failed = ferror(stream->file);
+        failed |= fclose(stream->file) != 0;
+        stream->file = NULL;
+        return failed ? -1 : 0;
+    }
+
+    int result = 0;
+    if (stream->diverged) {
+        result = -1;
+    } else if (stream->next < stream->count) {
+        fprintf(stderr, "stopped at frame %llu, golden stream continues to frame %llu\n",
+                (unsigned long long)frames, (unsigned long long)stream->entries[stream->count - 1].frame);
+        result = -1;
+    } else if (frames != stream->end_frame || cycles != stream->end_cycle) {
+        fprintf(stderr, "stopped at frame %llu (cycle %llu), golden stream ends at frame %llu (cycle %llu)\n",
+                (unsigned long long)frames, (unsigned long long)cycles,
+                (unsigned long long)stream->end_frame, (unsigned long long)stream->end_cycle);
+        result = -1;
+    }
+
+    free(stream->entries);
+    stream->entries = NULL;
+    return result;
+}
@@ -0,0 +1,69 @@
+#ifndef FRAME_HASH_H
+#define FRAME_HASH_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "state.h"
+#include "xchip.h"
+
+/*
+A frame hash stream is hash_video, or xchip_hash_video for the extended
+machines, taken at frame boundaries, either every frame or only the frames
+that drew something (video_dirty set). As text:
+
+    C8FH <version> <all|changes> <cycles per frame> <seed>
+    <frame> <cycle> <hash>
+    ...
+    end <frames> <cycles>
+
+Written while a ROM runs headlessly, it is a golden record of what the
+screen did; compared against, it finds the first frame a later build draws
+differently. Frames count from 1, the first frame boundary.
+*/
+
+#define FRAME_HASH_VERSION 1
+
+typedef struct {
+    uint64_t frame;
+    uint64_t cycle;
+    uint64_t hash;
+} frame_hash_entry;
+
+typedef struct {
+    int comparing; // 0 when writing
+    int changes_only;
+    uint16_t cycles_per_frame;
+    uint64_t seed;
+
+    // writing
+    FILE *file;
+
+    // comparing, the whole golden stream
+    frame_hash_entry *entries;
+    size_t count;
+    size_t next;
+    uint64_t end_frame;
+    uint64_t end_cycle;
+    int diverged; // already reported, so close doesn't pile on
+} frame_hash_stream;
+
+// start writing a stream, returns 0 on success
+int frame_hash_open_write(frame_hash_stream *stream, char const *path, int changes_only, uint16_t cycles_per_frame, uint64_t seed);
+
+// Load a golden stream to compare against, returns 0 on success. The mode,
+// cycles per frame, seed and length it was recorded with are filled in.
+int frame_hash_open_compare(frame_hash_stream *stream, char const *path);
+
+// Call at every frame boundary. Writes or checks this frame's hash and
+// clears video_dirty. Returns 0, or -1 after reporting the first divergence
+// on stderr.
+int frame_hash_step(frame_hash_stream *stream, chip8_state *state, uint64_t frame, uint64_t cycle);
+
+// As frame_hash_step, for SUPER-CHIP and XO-CHIP, with xchip_hash_video
+int frame_hash_step_xchip(frame_hash_stream *stream, xchip_state *state, uint64_t frame, uint64_t cycle);
+
+// Finish the stream at the given point. When comparing, checks that the
+// golden stream ends there too. Returns 0, or -1 on a mismatch or I/O error.
+int frame_hash_close(frame_hash_stream *stream, uint64_t frames, uint64_t cycles);
+
+#endif // FRAME_HASH_H
@@ -0,0 +1,409 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "state.h"
+#include "loadROM.h"
+#include "cpu.h"
+#include "frame_hash.h"
+#include "input_script.h"
+#include "jit.h"
+#include "profile.h"
+#include "scheduler.h"
+#include "stats.h"
+#include "video_export.h"
+#include "xchip.h"
+
+#define DEFAULT_CYCLE_BUDGET 1000000
+
+static void usage(char const *prog) {
+    fprintf(stderr, "Usage: %s [-c <Cycles> | -f <Frames>] [-p <CyclesPerFrame>] [-s <Seed>] [-i <InputScript>]\n"
+                    "       [-H <HashFile> [-C] | -G <GoldenFile>] [-V <VideoFile> [-x <Scale>] [-R] [-D]]\n"
+                    "       [-J] [-S <StatsFile>] [-P <ProfileFile>] [-m <Machine>] <ROM>\n", prog);
+}
+
+static void print_summary(FILE *report, uint64_t executed, uint64_t cycles_per_frame, double elapsed, uint64_t video_hash) {
+    double ips = elapsed > 0 ? executed / elapsed : 0;
+    fprintf(report, "cycles: %llu\n", (unsigned long long)executed);
+    fprintf(report, "frames: %llu\n", (unsigned long long)(executed / cycles_per_frame));
+    fprintf(report, "seconds: %.6f\n", elapsed);
+    fprintf(report, "instructions/sec: %.0f (%.2f MIPS)\n", ips, ips / 1e6);
+    fprintf(report, "video hash: %016llx\n", (unsigned long long)video_hash);
+}
+
+// Finish a hash stream, reporting whether a golden one matched. Returns 0
+// on success.
+static int close_hashes(FILE *report, frame_hash_stream *hashes, uint64_t executed, uint64_t cycles_per_frame) {
+    int mismatch = frame_hash_close(hashes, executed / cycles_per_frame, executed) != 0;
+    if (hashes->comparing) {
+        fprintf(report, "golden: %s\n", mismatch ? "FAILED" : "matched");
+    }
+    return mismatch ? -1 : 0;
+}
+
+// Write the counters and the call tree to whichever files were asked for,
+// returns 0 on success
+static int save_stats(chip8_state *state, char const *stats_path, char const *profile_path) {
+    int failed = 0;
+#ifdef CHIP8_STATS
+    if (stats_path != NULL) {
+        failed |= stats_save(state, stats_path) != 0;
+    }
+#else
+    (void)stats_path;
+#endif
+    if (profile_path != NULL) {
+        failed |= profile_save_folded(state->profile, profile_path) != 0;
+    }
+    return failed ? -1 : 0;
+}
+
+// SUPER-CHIP and XO-CHIP: the same frame loop on the extended machine's
+// core, chosen here once. hashes is NULL unless hashing.
+static int run_extended(machine_type machine, char const *rom_file_name, uint64_t seed,
+                        uint64_t cycle_budget, uint64_t cycles_per_frame, input_script *script,
+                        frame_hash_stream *hashes) {
+    xchip_state state;
+    xchip_initialise(&state, machine, seed);
+    int rom_error = xchip_load_rom(rom_file_name, &state);
+    if (rom_error != ROM_OK) {
+        fprintf(stderr, "Failed to load %s: %s\n", rom_file_name, rom_error_string(rom_error));
+        return EXIT_FAILURE;
+    }
+    xchip_run_fn run = xchip_core(machine);
+
+    double start = monotonic_seconds();
+    uint64_t executed = 0;
+    while (executed < cycle_budget) {
+        uint64_t frame_end = executed + cycles_per_frame;
+        if (frame_end > cycle_budget) {
+            frame_end = cycle_budget;
+        }
+
+        while (executed < frame_end) {
+            input_script_apply(script, &state.keys, executed);
+
+            uint64_t chunk = frame_end - executed;
+            uint64_t next_event = input_script_next_cycle(script);
+            if (next_event - executed < chunk) {
+                chunk = next_event - executed;
+            }
+            executed += run(&state, chunk);
+        }
+
+        if (executed % cycles_per_frame == 0) {
+            xchip_tick_timers(&state);
+            if (hashes && frame_hash_step_xchip(hashes, &state, executed / cycles_per_frame, executed) != 0) {
+                break;
+            }
+        }
+    }
+    double elapsed = monotonic_seconds() - start;
+
+    print_summary(stdout, executed, cycles_per_frame, elapsed, xchip_hash_video(&state));
+
+    int failed = 0;
+    if (hashes) {
+        failed = close_hashes(stdout, hashes, executed, cycles_per_frame) != 0;
+    }
+    return failed ? EXIT_FAILURE : 0;
+}
+
+int main(int argc, char **argv) {
+    uint64_t cycle_budget = DEFAULT_CYCLE_BUDGET;
+    uint64_t frame_budget = 0;
+    uint64_t cycles_per_frame = DEFAULT_CYCLES_PER_FRAME;
+    uint64_t seed = 0;
+    int use_jit = 0;
+    char const *stats_path = NULL;
+    char const *profile_path = NULL;
+    char const *script_path = NULL;
+    char const *hash_path = NULL;
+    char const *golden_path = NULL;
+    int hash_changes_only = 0;
+    char const *video_path = NULL;
+    video_format format = VIDEO_Y4M;
+    int video_scale = 1;
+    int skip_duplicates = 0;
+    int have_budget = 0, have_cycles_per_frame = 0, have_seed = 0;
+    int machine = -1;
+    int opt;
+
+    // Parse command line arguments
+    while ((opt = getopt(argc, argv, "c:f:p:s:i:H:G:CV:x:RDJS:P:m:")) != -1) {
+        switch (opt) {
+            case 'c':
+                cycle_budget = strtoull(optarg, NULL, 10);
+                have_budget = 1;
+                break;
+            case 'f':
+                frame_budget = strtoull(optarg, NULL, 10);
+                have_budget = 1;
+                break;
+            case 'p':
+                cycles_per_frame = strtoull(optarg, NULL, 10);
+                have_cycles_per_frame = 1;
+                break;
+            case 's':
+                seed = strtoull(optarg, NULL, 0);
+                have_seed = 1;
+                break;
+            case 'i':
+                script_path = optarg;
+                break;
+            case 'H':
+                hash_path = optarg;
+                break;
+            case 'G':
+                golden_path = optarg;
+                break;
+            case 'C':
+                hash_changes_only = 1;
+                break;
+            case 'V':
+                video_path = optarg;
+                break;
+            case 'x':
+                video_scale = atoi(optarg);
+                break;
+            case 'R':
+                format = VIDEO_RGBA;
+                break;
+            case 'D':
+                skip_duplicates = 1;
+                break;
+            case 'J':
+                use_jit = 1;
+                break;
+            case 'S':
+                stats_path = optarg;
+                break;
+            case 'P':
+                profile_path = optarg;
+                break;
+            case 'm':
+                machine = machine_from_name(optarg);
+                if (machine < 0) {
+                    fprintf(stderr, "Unknown machine %s, expected chip8, schip or xochip\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1 || cycles_per_frame == 0 || (hash_path && golden_path)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    char *rom_file_name = argv[optind];
+    if (machine < 0) {
+        machine = machine_from_rom(rom_file_name);
+    }
+
+    // A recorded log replays with the settings it was made with and runs to
+    // where the session stopped, unless told otherwise
+    input_script script = { 0 };
+    if (script_path != NULL) {
+        if (input_script_load(script_path, &script) != 0) {
+            return EXIT_FAILURE;
+        }
+        if (script.has_header) {
+            if (!have_cycles_per_frame && script.cycles_per_frame > 0) {
+                cycles_per_frame = script.cycles_per_frame;
+            }
+            if (!have_seed) {
+                seed = script.seed;
+            }
+            if (!have_budget) {
+                cycle_budget = script.end_cycle;
+            }
+        }
+    }
+
+    // Likewise a golden hash stream is checked under the settings that made
+    // it, to the frame it ends on
+    frame_hash_stream hashes;
+    int hashing = hash_path != NULL || golden_path != NULL;
+    if (golden_path != NULL) {
+        if (frame_hash_open_compare(&hashes, golden_path) != 0) {
+            return EXIT_FAILURE;
+        }
+        if (!have_cycles_per_frame && hashes.cycles_per_frame > 0) {
+            cycles_per_frame = hashes.cycles_per_frame;
+        }
+        if (!have_seed) {
+            seed = hashes.seed;
+        }
+        if (!have_budget) {
+            cycle_budget = hashes.end_cycle;
+        }
+    }
+
+    // a frame budget overrides the cycle budget
+    if (frame_budget > 0) {
+        cycle_budget = frame_budget * cycles_per_frame;
+    }
+
+    if (hash_path != NULL && frame_hash_open_write(&hashes, hash_path, hash_changes_only, cycles_per_frame, seed) != 0) {
+        return EXIT_FAILURE;
+    }
+
+    // the recompiler, video, stats and profiles only know the CHIP-8 machine
+    int counting = stats_path != NULL || profile_path != NULL;
+    if (machine != MACHINE_CHIP8) {
+        if (use_jit || video_path != NULL || counting) {
+            fprintf(stderr, "-J, -V, -S and -P are CHIP-8 only, not for %s\n", machine_name(machine));
+            input_script_free(&script);
+            return EXIT_FAILURE;
+        }
+        int result = run_extended(machine, rom_file_name, seed, cycle_budget, cycles_per_frame, &script,
+                                  hashing ? &hashes : NULL);
+        input_script_free(&script);
+        return result;
+    }
+
+    // Initialise Chip-8 state
+    chip8_state state;
+    initialise_state(&state, seed);
+    int rom_error = loadROM(rom_file_name, &state);
+    if (rom_error != ROM_OK) {
+        fprintf(stderr, "Failed to load %s: %s\n", rom_file_name, rom_error_string(rom_error));
+        return EXIT_FAILURE;
+    }
+
+    // Counters go to stats_path and the call tree to profile_path at exit,
+    // and in stats builds whenever SIGUSR1 arrives. The call tree needs no
+    // stats build.
+#ifdef CHIP8_STATS
+    if (stats_path != NULL) {
+        state.stats = stats_create();
+        if (state.stats == NULL) {
+            return EXIT_FAILURE;
+        }
+    }
+    if (counting) {
+        stats_install_signal();
+    }
+#else
+    if (stats_path != NULL) {
+        fprintf(stderr, "Built without stats, rebuild with make STATS=1\n");
+        return EXIT_FAILURE;
+    }
+#endif
+    if (profile_path != NULL) {
+        state.profile = profile_create();
+        if (state.profile == NULL) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Video written to standard output moves the summary to stderr
+    FILE *report = stdout;
+    video_export *video = NULL;
+    if (video_path != NULL) {
+        video = video_export_open(video_path, format, video_scale, skip_duplicates);
+        if (video == NULL) {
+            return EXIT_FAILURE;
+        }
+        if (strcmp(video_path, "-") == 0) {
+            report = stderr;
+        }
+    }
+
+    jit_context *jit = NULL;
+    if (use_jit) {
+        jit = jit_create();
+        if (jit == NULL) {
+            fprintf(stderr, "JIT not available on this host, interpreting\n");
+        }
+    }
+
+    // Run flat out, no window and no pacing. The timers still tick once
+    // every cycles_per_frame instructions so games behave as they would
+    // on screen, and each frame is split wherever an input event lands.
+    double start = monotonic_seconds();
+    uint64_t executed = 0;
+    while (executed < cycle_budget) {
+        // Parked on a key wait, skip whole frames up to the next input event,
+        // unless each of them has to be hashed or written out
+        input_script_apply(&script, &state.keys, executed);
+        if (!hashing && video == NULL && emu_waiting_for_key(&state)) {
+            uint64_t until = input_script_next_cycle(&script);
+            if (until > cycle_budget) {
+                until = cycle_budget;
+            }
+            uint64_t idle_frames = (until - executed) / cycles_per_frame;
+            if (idle_frames > 0) {
+                emu_idle_frames(&state, idle_frames, cycles_per_frame);
+                executed += idle_frames * cycles_per_frame;
+                if (state.profile) {
+                    profile_charge(state.profile, idle_frames * cycles_per_frame);
+                }
+                continue;
+            }
+        }
+
+        uint64_t frame_end = executed + cycles_per_frame;
+        if (frame_end > cycle_budget) {
+            frame_end = cycle_budget;
+        }
+
+        while (executed < frame_end) {
+            input_script_apply(&script, &state.keys, executed);
+
+            uint64_t chunk = frame_end - executed;
+            uint64_t next_event = input_script_next_cycle(&script);
+            if (next_event - executed < chunk) {
+                chunk = next_event - executed;
+            }
+            uint64_t ran = jit ? jit_run(jit, &state, chunk) : emu_run(&state, chunk);
+            if (state.profile) {
+                profile_charge(state.profile, ran);
+            }
+            executed += ran;
+        }
+
+        if (executed % cycles_per_frame == 0) {
+            emu_tick_timers(&state);
+            if (hashing && frame_hash_step(&hashes, &state, executed / cycles_per_frame, executed) != 0) {
+                break;
+            }
+            if (video && video_export_frame(video, state.video) != 0) {
+                break;
+            }
+        }
+#ifdef CHIP8_STATS
+        if (counting && stats_dump_requested()) {
+            save_stats(&state, stats_path, profile_path);
+        }
+#endif
+    }
+    double elapsed = monotonic_seconds() - start;
+    jit_destroy(jit);
+    input_script_free(&script);
+
+    int failed = 0;
+    if (video) {
+        failed = video_export_close(video) != 0;
+    }
+
+    print_summary(report, executed, cycles_per_frame, elapsed, hash_video(&state));
+
+    if (hashing) {
+        failed |= close_hashes(report, &hashes, executed, cycles_per_frame) != 0;
+    }
+
+    if (counting) {
+        failed |= save_stats(&state, stats_path, profile_path) != 0;
+    }
+#ifdef CHIP8_STATS
+    stats_destroy(state.stats);
+#endif
+    profile_destroy(state.profile);
+
+    return failed ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,54 @@
+#include "input_queue.h"
+#include <errno.h>
+
+#define INPUT_QUEUE_MASK (INPUT_QUEUE_SIZE - 1)
+
+int input_queue_init(input_queue *queue) {
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    return sem_init(&queue->pushed, 0, 0);
+}
+
+void input_queue_destroy(input_queue *queue) {
+    sem_destroy(&queue->pushed);
+}
+
+int input_queue_push(input_queue *queue, input_message_type type, uint8_t down, uint16_t keys) {
+    uint32_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+    int result = -1;
+
+    if (head - tail < INPUT_QUEUE_SIZE) {
+        input_message *message = &queue->ring[head & INPUT_QUEUE_MASK];
+        message->type = type;
+        message->down = down;
+        message->keys = keys;
+        atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+        result = 0;
+    }
+
+    sem_post(&queue->pushed);
+    return result;
+}
+
+int input_queue_pop(input_queue *queue, input_message *message) {
+    uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+    if (tail == head) {
+        return 0;
+    }
+
+    *message = queue->ring[tail & INPUT_QUEUE_MASK];
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    return 1;
+}
+
+void input_queue_wait(input_queue *queue) {
+    while (sem_wait(&queue->pushed) != 0 && errno == EINTR) {
+    }
+
+    // Swallow the count from earlier pushes too. Every post follows its
+    // message into the ring, so the caller's next pops see all of them.
+    while (sem_trywait(&queue->pushed) == 0) {
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef INPUT_QUEUE_H
+#define INPUT_QUEUE_H
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+/*
+Carries input from the render thread, which owns the SDL event loop, to the
+emulation thread. A single-producer single-consumer ring: push and pop each
+touch only their own index and never block. A semaphore counts pushes so an
+idle emulation thread can sleep until there's input, without the producer
+taking any lock.
+*/
+
+#define INPUT_QUEUE_SIZE 256 // a power of two
+
+typedef enum {
+    INPUT_KEYS,       // keys is the new keypad bitmask
+    INPUT_REWIND,     // down while rewind is held
+    INPUT_TURBO,      // down while fast-forward is held
+    INPUT_SAVE_STATE,
+    INPUT_LOAD_STATE,
+    INPUT_QUIT,
+} input_message_type;
+
+typedef struct {
+    uint8_t type;
+    uint8_t down;
+    uint16_t keys;
+} input_message;
+
+typedef struct {
+    input_message ring[INPUT_QUEUE_SIZE];
+    _Atomic uint32_t head; // next slot to write, advanced by the producer
+    _Atomic uint32_t tail; // next slot to read, advanced by the consumer
+    sem_t pushed;
+} input_queue;
+
+// returns 0 on success
+int input_queue_init(input_queue *queue);
+void input_queue_destroy(input_queue *queue);
+
+// Producer: append a message. Returns -1, dropping it, if the queue is full;
+// the consumer is woken either way.
+int input_queue_push(input_queue *queue, input_message_type type, uint8_t down, uint16_t keys);
+
+// consumer: take the oldest message, returns 0 if the queue was empty
+int input_queue_pop(input_queue *queue, input_message *message);
+
+// Consumer: sleep until something has been pushed. A push that was already
+// popped can still end one wait early, so pop, and wait again if empty.
+void input_queue_wait(input_queue *queue);
+
+#endif // INPUT_QUEUE_H
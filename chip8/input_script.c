@@ -0,0 +1,203 @@
+#include "input_script.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const uint8_t LOG_MAGIC[4] = { 'C', '8', 'I', 'N' };
+#define LOG_HEADER_SIZE 16
+
+// append an event, growing the array as needed. returns 0 on success
+static int push_event(input_script *script, size_t *capacity, uint64_t cycle, uint8_t key, uint8_t down) {
+    if (script->count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 64;
+        input_event *grown = realloc(script->events, *capacity * sizeof(input_event));
+        if (grown == NULL) {
+            return -1;
+        }
+        script->events = grown;
+    }
+
+    input_event *ev = &script->events[script->count++];
+    ev->cycle = cycle;
+    ev->key = key;
+    ev->down = down;
+    return 0;
+}
+
+static int load_text(char const *path, FILE *fptr, input_script *script) {
+    size_t capacity = 0;
+    char line[256];
+    int line_number = 0;
+    uint64_t last_cycle = 0;
+
+    while (fgets(line, sizeof(line), fptr)) {
+        ++line_number;
+        unsigned long long cycle;
+        unsigned int key, down;
+
+        char *p = line;
+        while (*p == ' ' || *p == '\t') {
+            ++p;
+        }
+        if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0') {
+            continue;
+        }
+
+        if (sscanf(p, "%llu %x %u", &cycle, &key, &down) != 3 || key >= NUM_KEYS || down > 1 || cycle < last_cycle) {
+            fprintf(stderr, "%s:%d: bad input event\n", path, line_number);
+            return -1;
+        }
+        last_cycle = cycle;
+
+        if (push_event(script, &capacity, cycle, key, down) != 0) {
+            return -1;
+        }
+    }
+
+    script->end_cycle = last_cycle;
+    return 0;
+}
+
+// read an unsigned LEB128 value, returns 0 on success
+static int read_varint(FILE *fptr, uint64_t *value) {
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int byte = fgetc(fptr);
+        if (byte == EOF) {
+            return -1;
+        }
+        *value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int load_binary(char const *path, FILE *fptr, input_script *script) {
+    // the magic has already been read
+    uint8_t header[LOG_HEADER_SIZE - sizeof(LOG_MAGIC)];
+    if (fread(header, 1, sizeof(header), fptr) != sizeof(header)) {
+        fprintf(stderr, "%s: truncated input log header\n", path);
+        return -1;
+    }
+
+    uint16_t version = header[0] | header[1] << 8;
+    if (version != INPUT_LOG_VERSION) {
+        fprintf(stderr, "%s: unsupported input log version %u\n", path, version);
+        return -1;
+    }
+    script->has_header = 1;
+    script->cycles_per_frame = header[2] | header[3] << 8;
+    script->seed = 0;
+    for (int i = 7; i >= 0; --i) {
+        script->seed = script->seed << 8 | header[4 + i];
+    }
+
+    size_t capacity = 0;
+    uint64_t cycle = 0;
+    for (;;) {
+        uint64_t delta;
+        int key = EOF;
+        if (read_varint(fptr, &delta) != 0 || (key = fgetc(fptr)) == EOF) {
+            fprintf(stderr, "%s: input log ends without an end marker\n", path);
+            return -1;
+        }
+        cycle += delta;
+
+        if ((key & 0x7F) == INPUT_LOG_END) {
+            script->end_cycle = cycle;
+            return 0;
+        }
+        if ((key & 0x7F) >= NUM_KEYS) {
+            fprintf(stderr, "%s: bad key in input log\n", path);
+            return -1;
+        }
+        if (push_event(script, &capacity, cycle, key & 0x7F, key >> 7) != 0) {
+            return -1;
+        }
+    }
+}
+
+int input_script_load(char const *path, input_script *script) {
+    memset(script, 0, sizeof(*script));
+
+    FILE *fptr = fopen(path, "rb");
+    if (fptr == NULL) {
+        fprintf(stderr, "Failed to open input script: %s\n", path);
+        return -1;
+    }
+
+    uint8_t magic[sizeof(LOG_MAGIC)];
+    int result;
+    if (fread(magic, 1, sizeof(magic), fptr) == sizeof(magic) && memcmp(magic, LOG_MAGIC, sizeof(magic)) == 0) {
+        result = load_binary(path, fptr, script);
+    } else {
+        rewind(fptr);
+        result = load_text(path, fptr, script);
+    }
+
+    fclose(fptr);
+    if (result != 0) {
+        input_script_free(script);
+    }
+    return result;
+}
+
+void input_script_free(input_script *script) {
+    free(script->events);
+    script->events = NULL;
+    script->count = 0;
+    script->next = 0;
+}
+
+// write one log entry, an LEB128 cycle delta then the key byte
+static void write_entry(input_recorder *rec, uint64_t cycle, uint8_t key) {
+    uint64_t delta = cycle - rec->last_cycle;
+    rec->last_cycle = cycle;
+
+    do {
+        uint8_t byte = delta & 0x7F;
+        delta >>= 7;
+        fputc(delta ? byte | 0x80 : byte, rec->file);
+    } while (delta);
+    fputc(key, rec->file);
+}
+
+int input_recorder_open(input_recorder *rec, char const *path, uint16_t cycles_per_frame, uint64_t seed) {
+    memset(rec, 0, sizeof(*rec));
+    rec->file = fopen(path, "wb");
+    if (rec->file == NULL) {
+        fprintf(stderr, "Failed to open input log: %s\n", path);
+        return -1;
+    }
+
+    uint8_t header[LOG_HEADER_SIZE];
+    memcpy(header, LOG_MAGIC, sizeof(LOG_MAGIC));
+    header[4] = INPUT_LOG_VERSION & 0xFF;
+    header[5] = INPUT_LOG_VERSION >> 8;
+    header[6] = cycles_per_frame & 0xFF;
+    header[7] = cycles_per_frame >> 8;
+    for (int i = 0; i < 8; ++i) {
+        header[8 + i] = seed >> (8 * i);
+    }
+    fwrite(header, 1, sizeof(header), rec->file);
+    return 0;
+}
+
+void input_recorder_update(input_recorder *rec, uint16_t keys, uint64_t cycle) {
+    uint16_t changed = keys ^ rec->keys;
+    rec->keys = keys;
+    for (; changed; changed &= changed - 1) {
+        uint8_t key = __builtin_ctz(changed);
+        write_entry(rec, cycle, (keys >> key & 1) << 7 | key);
+    }
+}
+
+int input_recorder_close(input_recorder *rec, uint64_t cycle) {
+    write_entry(rec, cycle, INPUT_LOG_END);
+    int failed = ferror(rec->file);
+    failed |= fclose(rec->file) != 0;
+    rec->file = NULL;
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,83 @@
+#ifndef INPUT_SCRIPT_H
+#define INPUT_SCRIPT_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "state.h"
+
+/*
+An input script is a list of key events, each stamped with the emulated cycle
+it takes effect on. As text, one event per line:
+
+    <cycle> <key> <1|0>
+
+key is the hex keypad value 0-F, 1 presses it and 0 releases it. Blank lines
+and lines starting with # are ignored. Events must be in cycle order.
+
+Recorded sessions use a compact binary log instead, all little-endian:
+
+    "C8IN" | u16 version | u16 cycles per frame | u64 seed
+    then per event: LEB128 cycles since the previous event | u8 key
+
+where the key byte is the keypad value, with the top bit set for a press.
+The log ends with the key byte INPUT_LOG_END, whose delta gives the cycle the
+session stopped on. input_script_load tells the two formats apart by the
+magic, so anything that replays a text script replays a log too.
+*/
+
+#define INPUT_LOG_VERSION 1
+#define INPUT_LOG_END 0x7F
+
+typedef struct {
+    uint64_t cycle;
+    uint8_t key;
+    uint8_t down;
+} input_event;
+
+typedef struct {
+    input_event *events;
+    size_t count;
+    size_t next; // replay cursor
+
+    // what the session was recorded with, only known for binary logs
+    int has_header;
+    uint16_t cycles_per_frame;
+    uint64_t seed;
+    uint64_t end_cycle; // where the recording stopped, else the last event
+} input_script;
+
+// Load a text script or a binary log from a file, returns 0 on success
+int input_script_load(char const *path, input_script *script);
+
+void input_script_free(input_script *script);
+
+// Writes a binary log by watching the keys change from frame to frame
+typedef struct {
+    FILE *file;
+    uint64_t last_cycle; // of the previous event written
+    uint16_t keys; // as of the last update
+} input_recorder;
+
+// start a log, returns 0 on success
+int input_recorder_open(input_recorder *rec, char const *path, uint16_t cycles_per_frame, uint64_t seed);
+
+// record whichever keys changed since the last update as taking effect at cycle
+void input_recorder_update(input_recorder *rec, uint16_t keys, uint64_t cycle);
+
+// end the log at cycle and close it, returns 0 if everything was written
+int input_recorder_close(input_recorder *rec, uint64_t cycle);
+
+// apply every event due at or before cycle to a keypad bitmask
+static inline void input_script_apply(input_script *script, uint16_t *keys, uint64_t cycle) {
+    while (script->next < script->count && script->events[script->next].cycle <= cycle) {
+        input_event const *ev = &script->events[script->next++];
+        *keys = (*keys & ~(1u << ev->key)) | (uint16_t)ev->down << ev->key;
+    }
+}
+
+// cycle of the next pending event, UINT64_MAX once the script is exhausted
+static inline uint64_t input_script_next_cycle(input_script const *script) {
+    return script->next < script->count ? script->events[script->next].cycle : UINT64_MAX;
+}
+
+#endif // INPUT_SCRIPT_H
@@ -0,0 +1,692 @@
+#include "jit.h"
+#include "cpu.h"
+
+// Stats builds count every instruction in emu_cycle, which translated blocks
+// would skip, so they always interpret.
+#if defined(__x86_64__) && !defined(_WIN32) && !defined(CHIP8_STATS)
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define CODE_BUFFER_SIZE (1 << 20)
+#define MAX_BLOCK_INSTRS 64
+#define MAX_BLOCK_BYTES 8192 // generous upper bound on one block's code
+
+// Where there's no block, this many instructions are handed to emu_run at a
+// time, with its computed-goto dispatch and superinstructions, before looking
+// for a block again. Compiled code reached meanwhile is just interpreted.
+#define INTERPRET_STRETCH 16
+
+// x86-64 register numbers
+enum {
+    RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+    R8 = 8, R9 = 9, R10 = 10, R11 = 11, R12 = 12, R13 = 13, R14 = 14, R15 = 15
+};
+
+// condition codes for setcc/cmovcc
+enum { CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_A = 0x7 };
+
+// RDI holds the chip8_state pointer and ESI the budget, RAX and RDX are
+// scratch. Everything else can hold a guest register for the length of a
+// block.
+static const uint8_t HOST_POOL[] = { RCX, R8, R9, R10, R11, RBX, RBP, R12, R13, R14, R15 };
+#define HOST_POOL_SIZE (sizeof(HOST_POOL) / sizeof(HOST_POOL[0]))
+#define GUEST_I NUM_V_REG // slot for the index register after V0-VF
+
+// Runs the block's first budget instructions, 1 to length, and returns how
+// many it ran
+typedef uint32_t (*block_fn)(chip8_state *state, uint32_t budget);
+
+enum { BLOCK_NONE = 0, BLOCK_COMPILED, BLOCK_INTERPRET };
+
+typedef struct {
+    block_fn code;
+    uint16_t end;    // one past the last byte of guest code translated
+    uint8_t length;  // guest instructions executed per run
+    uint8_t kind;
+} jit_block;
+
+// The code buffer is never writable and executable at once: it is mapped
+// read+execute, and the pages a block is about to be written to are made
+// read+write just for the time it takes to translate it
+struct jit_context {
+    uint8_t *code;
+    size_t code_used;
+    size_t page_size;
+    jit_block blocks[MEMORY_SPACE]; // indexed by guest start address
+    uint8_t covered[MEMORY_SPACE];  // non-zero if some block translated this byte
+};
+
+// How an instruction is handled by the translator
+enum { OP_INTERPRET = 0, OP_BODY, OP_TERMINATOR };
+
+static int classify(uint16_t opcode) {
+    switch (opcode >> 12) {
+        case 0x1: case 0x3: case 0x4: case 0x5: case 0x9: case 0xB:
+            return OP_TERMINATOR;
+        case 0x6: case 0x7: case 0xA:
+            return OP_BODY;
+        case 0x8:
+            switch (opcode & 0x000Fu) {
+                case 0x0: case 0x1: case 0x2: case 0x3: case 0x4:
+                case 0x5: case 0x6: case 0x7: case 0xE:
+                    return OP_BODY;
+            }
+            return OP_INTERPRET;
+        case 0xF:
+            switch (opcode & 0x00FFu) {
+                case 0x1E: case 0x29:
+                    return OP_BODY;
+            }
+            return OP_INTERPRET;
+        default:
+            return OP_INTERPRET;
+    }
+}
+
+// guest registers an instruction touches, as a bitmask over V0-VF and I
+static uint32_t guest_uses(decoded_instr const *in) {
+    uint32_t x = 1u << in->x, y = 1u << in->y, vf = 1u << 0xF, i = 1u << GUEST_I;
+
+    switch (in->opcode >> 12) {
+        case 0x3: case 0x4: case 0x6: case 0x7:
+            return x;
+        case 0x5: case 0x9:
+            return x | y;
+        case 0x8:
+            return x | y | vf;
+        case 0xA:
+            return i;
+        case 0xB:
+            return 1u;
+        case 0xF:
+            return x | i;
+        default:
+            return 0;
+    }
+}
+
+// Code emission
+
+typedef struct {
+    uint8_t *p;
+} emitter;
+
+static void emit8(emitter *e, uint8_t b) {
+    *e->p++ = b;
+}
+
+static void emit32(emitter *e, uint32_t v) {
+    memcpy(e->p, &v, 4);
+    e->p += 4;
+}
+
+static void emit_rex(emitter *e, int force, int reg, int rm) {
+    uint8_t rex = 0x40 | ((reg >> 3) & 1) << 2 | ((rm >> 3) & 1);
+    if (force || rex != 0x40) {
+        emit8(e, rex);
+    }
+}
+
+// <op> r/m32(dst), r32(src): mov, add, or, and, sub, xor, cmp
+static void emit_rr(emitter *e, uint8_t op, int dst, int src) {
+    emit_rex(e, 0, src, dst);
+    emit8(e, op);
+    emit8(e, 0xC0 | (src & 7) << 3 | (dst & 7));
+}
+
+static void emit_mov_rr(emitter *e, int dst, int src) {
+    if (dst != src) {
+        emit_rr(e, 0x89, dst, src);
+    }
+}
+
+static void emit_mov_ri(emitter *e, int dst, uint32_t imm) {
+    emit_rex(e, 0, 0, dst);
+    emit8(e, 0xB8 + (dst & 7));
+    emit32(e, imm);
+}
+
+// <group1 op> r/m32, imm32: /0 add, /4 and, /7 cmp
+static void emit_ri(emitter *e, int ext, int dst, uint32_t imm) {
+    emit_rex(e, 0, 0, dst);
+    emit8(e, 0x81);
+    emit8(e, 0xC0 | ext << 3 | (dst & 7));
+    emit32(e, imm);
+}
+
+// shift r/m32 by imm8: /4 shl, /5 shr
+static void emit_shift(emitter *e, int ext, int dst, uint8_t count) {
+    emit_rex(e, 0, 0, dst);
+    emit8(e, 0xC1);
+    emit8(e, 0xC0 | ext << 3 | (dst & 7));
+    emit8(e, count);
+}
+
+// eax = condition ? 1 : 0, from the flags of the last compare
+static void emit_setcc_eax(emitter *e, int cc) {
+    emit8(e, 0x0F);
+    emit8(e, 0x90 | cc);
+    emit8(e, 0xC0); // al
+    emit8(e, 0x0F);
+    emit8(e, 0xB6);
+    emit8(e, 0xC0); // movzx eax, al
+}
+
+static void emit_cmov(emitter *e, int cc, int dst, int src) {
+    emit_rex(e, 0, dst, src);
+    emit8(e, 0x0F);
+    emit8(e, 0x40 | cc);
+    emit8(e, 0xC0 | (dst & 7) << 3 | (src & 7));
+}
+
+// [rdi + disp32] operand
+static void emit_state_operand(emitter *e, int reg, uint32_t disp) {
+    emit8(e, 0x80 | (reg & 7) << 3 | RDI);
+    emit32(e, disp);
+}
+
+static void emit_load8(emitter *e, int dst, uint32_t disp) {
+    emit_rex(e, 0, dst, RDI);
+    emit8(e, 0x0F);
+    emit8(e, 0xB6);
+    emit_state_operand(e, dst, disp);
+}
+
+static void emit_load16(emitter *e, int dst, uint32_t disp) {
+    emit_rex(e, 0, dst, RDI);
+    emit8(e, 0x0F);
+    emit8(e, 0xB7);
+    emit_state_operand(e, dst, disp);
+}
+
+static void emit_store8(emitter *e, int src, uint32_t disp) {
+    // always emit REX so 4-7 mean spl/bpl/sil/dil, not ah/ch/dh/bh
+    emit_rex(e, 1, src, RDI);
+    emit8(e, 0x88);
+    emit_state_operand(e, src, disp);
+}
+
+static void emit_store16(emitter *e, int src, uint32_t disp) {
+    emit8(e, 0x66);
+    emit_rex(e, 0, src, RDI);
+    emit8(e, 0x89);
+    emit_state_operand(e, src, disp);
+}
+
+// mov dword [rdi + disp32], imm32
+static void emit_store_imm32(emitter *e, uint32_t disp, uint32_t imm) {
+    emit8(e, 0xC7);
+    emit_state_operand(e, 0, disp);
+    emit32(e, imm);
+}
+
+static int is_callee_saved(int reg) {
+    return reg == RBX || reg == RBP || reg >= R12;
+}
+
+static void emit_push(emitter *e, int reg) {
+    emit_rex(e, 0, 0, reg);
+    emit8(e, 0x50 + (reg & 7));
+}
+
+static void emit_pop(emitter *e, int reg) {
+    emit_rex(e, 0, 0, reg);
+    emit8(e, 0x58 + (reg & 7));
+}
+
+// cmp esi, imm8
+static void emit_cmp_budget(emitter *e, uint8_t imm) {
+    emit8(e, 0x83);
+    emit8(e, 0xC0 | 7 << 3 | RSI);
+    emit8(e, imm);
+}
+
+// je / jmp rel32 to a target not known yet, returns where to patch it
+static uint8_t *emit_je_forward(emitter *e) {
+    emit8(e, 0x0F);
+    emit8(e, 0x84);
+    emit32(e, 0);
+    return e->p - 4;
+}
+
+static uint8_t *emit_jmp_forward(emitter *e) {
+    emit8(e, 0xE9);
+    emit32(e, 0);
+    return e->p - 4;
+}
+
+// point a rel32 emitted earlier at target
+static void patch_rel32(uint8_t *at, uint8_t const *target) {
+    int32_t rel = (int32_t)(target - (at + 4));
+    memcpy(at, &rel, 4);
+}
+
+// Translation
+
+#define V_DISP(i) ((uint32_t)(offsetof(chip8_state, v_register) + (i)))
+#define I_DISP ((uint32_t)offsetof(chip8_state, index_register))
+#define PC_DISP ((uint32_t)offsetof(chip8_state, program_counter))
+#define OPCODE_DISP ((uint32_t)offsetof(chip8_state, opcode))
+
+static void translate_body(emitter *e, decoded_instr const *in, int const *host) {
+    int rx = host[in->x], ry = host[in->y], rf = host[0xF], ri = host[GUEST_I];
+
+    switch (in->opcode >> 12) {
+        case 0x6:
+            emit_mov_ri(e, rx, in->kk);
+            return;
+        case 0x7:
+            emit_ri(e, 0, rx, in->kk);
+            emit_ri(e, 4, rx, 0xFF);
+            return;
+        case 0xA:
+            emit_mov_ri(e, ri, in->nnn);
+            return;
+        case 0xF:
+            if (in->kk == 0x1E) {
+                emit_rr(e, 0x01, ri, rx);
+                emit_ri(e, 4, ri, 0xFFFF);
+            } else { // Fx29
+                emit_mov_rr(e, RAX, rx);
+                emit_shift(e, 4, RAX, 2);
+                emit_rr(e, 0x01, RAX, rx);
+                emit_ri(e, 0, RAX, FONT_OFFSET);
+                emit_mov_rr(e, ri, RAX);
+            }
+            return;
+    }
+
+    // 8xy_ as alu_8xy has it: operands are read before Vx is written, and
+    // VF is written last, so that x or y being F comes out the same
+    switch (in->n) {
+        case 0x0:
+            emit_mov_rr(e, rx, ry);
+            break;
+        case 0x1:
+            emit_rr(e, 0x09, rx, ry);
+            break;
+        case 0x2:
+            emit_rr(e, 0x21, rx, ry);
+            break;
+        case 0x3:
+            emit_rr(e, 0x31, rx, ry);
+            break;
+        case 0x4:
+            emit_mov_rr(e, RAX, rx);
+            emit_rr(e, 0x01, RAX, ry);
+            emit_mov_rr(e, RDX, RAX);
+            emit_shift(e, 5, RDX, 8);
+            emit_ri(e, 4, RAX, 0xFF);
+            emit_mov_rr(e, rx, RAX);
+            emit_mov_rr(e, rf, RDX);
+            break;
+        case 0x5:
+            emit_mov_rr(e, RDX, rx);
+            emit_rr(e, 0x29, RDX, ry);
+            emit_ri(e, 4, RDX, 0xFF);
+            emit_rr(e, 0x39, rx, ry);
+            emit_setcc_eax(e, CC_AE);
+            emit_mov_rr(e, rx, RDX);
+            emit_mov_rr(e, rf, RAX);
+            break;
+        case 0x6:
+            emit_mov_rr(e, RAX, rx);
+            emit_ri(e, 4, RAX, 0x1);
+            emit_shift(e, 5, rx, 1);
+            emit_mov_rr(e, rf, RAX);
+            break;
+        case 0x7:
+            emit_mov_rr(e, RDX, ry);
+            emit_rr(e, 0x29, RDX, rx);
+            emit_ri(e, 4, RDX, 0xFF);
+            emit_rr(e, 0x39, ry, rx);
+            emit_setcc_eax(e, CC_AE);
+            emit_mov_rr(e, rx, RDX);
+            emit_mov_rr(e, rf, RAX);
+            break;
+        case 0xE:
+            emit_mov_rr(e, RAX, rx);
+            emit_shift(e, 5, RAX, 7);
+            emit_shift(e, 4, rx, 1);
+            emit_ri(e, 4, rx, 0xFF);
+            emit_mov_rr(e, rf, RAX);
+            break;
+    }
+}
+
+// leaves the next guest PC in eax
+static void translate_terminator(emitter *e, decoded_instr const *in, uint16_t address, int const *host) {
+    int rx = host[in->x], ry = host[in->y];
+    uint16_t next = address + 2;
+
+    switch (in->opcode >> 12) {
+        case 0x1:
+            emit_mov_ri(e, RAX, in->nnn);
+            return;
+        case 0xB:
+            emit_mov_rr(e, RAX, host[0]);
+            emit_ri(e, 0, RAX, in->nnn);
+            return;
+    }
+
+    // skips: eax = condition ? next + 2 : next
+    emit_mov_ri(e, RAX, next);
+    emit_mov_ri(e, RDX, (uint16_t)(next + 2));
+    switch (in->opcode >> 12) {
+        case 0x3:
+            emit_ri(e, 7, rx, in->kk);
+            emit_cmov(e, CC_E, RAX, RDX);
+            break;
+        case 0x4:
+            emit_ri(e, 7, rx, in->kk);
+            emit_cmov(e, CC_NE, RAX, RDX);
+            break;
+        case 0x5:
+            emit_rr(e, 0x39, rx, ry);
+            emit_cmov(e, CC_E, RAX, RDX);
+            break;
+        case 0x9:
+            emit_rr(e, 0x39, rx, ry);
+            emit_cmov(e, CC_NE, RAX, RDX);
+            break;
+    }
+}
+
+// Switch the pages covering code[offset, offset + length) between writable
+// and executable, returns 0 on success
+static int protect_code(jit_context *jit, size_t offset, size_t length, int writable) {
+    size_t first = offset & ~(jit->page_size - 1);
+    size_t end = (offset + length + jit->page_size - 1) & ~(jit->page_size - 1);
+    if (end > CODE_BUFFER_SIZE) {
+        end = CODE_BUFFER_SIZE;
+    }
+    int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC;
+    return mprotect(jit->code + first, end - first, prot);
+}
+
+static uint16_t fetch(chip8_state const *state, uint16_t address) {
+    return (state->memory[address] << 8) | state->memory[address + 1];
+}
+
+// Translate the block starting at start, filling in *block
+static void translate(jit_context *jit, chip8_state const *state, uint16_t start, jit_block *block) {
+    decoded_instr instrs[MAX_BLOCK_INSTRS];
+    uint32_t used = 0, written = 0;
+    int count = 0, terminated = 0;
+    uint16_t address = start;
+
+    // find the extent of the block and the guest registers it needs
+    while (count < MAX_BLOCK_INSTRS && address + 1 < MEMORY_SPACE) {
+        decoded_instr in = decode_opcode(fetch(state, address));
+        int kind = classify(in.opcode);
+        if (kind == OP_INTERPRET) {
+            break;
+        }
+
+        uint32_t uses = used | guest_uses(&in);
+        if ((unsigned)__builtin_popcount(uses) > HOST_POOL_SIZE) {
+            break;
+        }
+        used = uses;
+        if (in.opcode >> 12 == 0x8) {
+            written |= 1u << in.x | 1u << 0xF;
+        } else if (kind == OP_BODY) {
+            written |= guest_uses(&in);
+        }
+
+        instrs[count++] = in;
+        address += 2;
+        if (kind == OP_TERMINATOR) {
+            terminated = 1;
+            break;
+        }
+    }
+
+    if (count == 0) {
+        block->kind = BLOCK_INTERPRET;
+        return;
+    }
+
+    if (jit->code_used + MAX_BLOCK_BYTES > CODE_BUFFER_SIZE) {
+        jit_flush(jit);
+    }
+    if (protect_code(jit, jit->code_used, MAX_BLOCK_BYTES, 1) != 0) {
+        block->kind = BLOCK_INTERPRET;
+        return;
+    }
+
+    // assign host registers
+    int host[NUM_V_REG + 1];
+    int saved[HOST_POOL_SIZE];
+    int num_saved = 0;
+    size_t next_host = 0;
+    for (int g = 0; g <= GUEST_I; ++g) {
+        host[g] = RAX; // unused guests never get touched
+        if (used & (1u << g)) {
+            host[g] = HOST_POOL[next_host++];
+            if (is_callee_saved(host[g])) {
+                saved[num_saved++] = host[g];
+            }
+        }
+    }
+
+    emitter e = { jit->code + jit->code_used };
+    uint8_t *entry = e.p;
+
+    for (int i = 0; i < num_saved; ++i) {
+        emit_push(&e, saved[i]);
+    }
+    for (int g = 0; g < NUM_V_REG; ++g) {
+        if (used & (1u << g)) {
+            emit_load8(&e, host[g], V_DISP(g));
+        }
+    }
+    if (used & (1u << GUEST_I)) {
+        emit_load16(&e, host[GUEST_I], I_DISP);
+    }
+
+    // Before each instruction after the first, leave if the budget is spent,
+    // so a frame's last few cycles still run here rather than one at a time
+    // in the interpreter. A compare and a branch that's never taken but
+    // once are all it costs.
+    uint8_t *budget_exits[MAX_BLOCK_INSTRS];
+    uint16_t instr_address = start;
+    for (int i = 0; i < count; ++i, instr_address += 2) {
+        if (i > 0) {
+            emit_cmp_budget(&e, (uint8_t)i);
+            budget_exits[i] = emit_je_forward(&e);
+        }
+        if (terminated && i == count - 1) {
+            translate_terminator(&e, &instrs[i], instr_address, host);
+        } else {
+            translate_body(&e, &instrs[i], host);
+        }
+    }
+    if (!terminated) {
+        emit_mov_ri(&e, RAX, address);
+    }
+    emit_store_imm32(&e, OPCODE_DISP, instrs[count - 1].opcode);
+    emit_mov_ri(&e, RDX, count);
+
+    // Write back, with the next PC in eax and the instructions run in edx.
+    // Each way out has already stored the opcode of the last instruction it
+    // ran, as emu_cycle would have left it.
+    // Registers written by instructions an early exit skipped still hold
+    // what was loaded, so storing every written register is always right.
+    uint8_t *write_back = e.p;
+    emit_store16(&e, RAX, PC_DISP);
+    for (int g = 0; g < NUM_V_REG; ++g) {
+        if (written & (1u << g)) {
+            emit_store8(&e, host[g], V_DISP(g));
+        }
+    }
+    if (written & (1u << GUEST_I)) {
+        emit_store16(&e, host[GUEST_I], I_DISP);
+    }
+    for (int i = num_saved - 1; i >= 0; --i) {
+        emit_pop(&e, saved[i]);
+    }
+    emit_mov_rr(&e, RAX, RDX);
+    emit8(&e, 0xC3); // ret
+
+    // the early exits, out of line
+    for (int i = 1; i < count; ++i) {
+        patch_rel32(budget_exits[i], e.p);
+        emit_mov_ri(&e, RAX, (uint16_t)(start + 2 * i));
+        emit_mov_ri(&e, RDX, i);
+        emit_store_imm32(&e, OPCODE_DISP, instrs[i - 1].opcode);
+        patch_rel32(emit_jmp_forward(&e), write_back);
+    }
+
+    // if the pages can't be made executable again, leave the block to the
+    // interpreter; the bytes are overwritten by the next translation
+    if (protect_code(jit, jit->code_used, MAX_BLOCK_BYTES, 0) != 0) {
+        block->kind = BLOCK_INTERPRET;
+        return;
+    }
+    jit->code_used += e.p - entry;
+    block->code = (block_fn)entry;
+    block->end = address;
+    block->length = count;
+    block->kind = BLOCK_COMPILED;
+    memset(&jit->covered[start], 1, address - start);
+}
+
+jit_context *jit_create(void) {
+    jit_context *jit = calloc(1, sizeof(jit_context));
+    if (jit == NULL) {
+        return NULL;
+    }
+
+    long page_size = sysconf(_SC_PAGESIZE);
+    jit->page_size = page_size > 0 ? (size_t)page_size : 4096;
+    jit->code = mmap(NULL, CODE_BUFFER_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->code == MAP_FAILED) {
+        free(jit);
+        return NULL;
+    }
+    return jit;
+}
+
+void jit_destroy(jit_context *jit) {
+    if (jit == NULL) {
+        return;
+    }
+    munmap(jit->code, CODE_BUFFER_SIZE);
+    free(jit);
+}
+
+void jit_flush(jit_context *jit) {
+    memset(jit->blocks, 0, sizeof(jit->blocks));
+    memset(jit->covered, 0, sizeof(jit->covered));
+    jit->code_used = 0;
+}
+
+void jit_invalidate(jit_context *jit, uint16_t address, uint16_t length) {
+    uint32_t first = address > 0 ? address - 1u : 0;
+    uint32_t last = (uint32_t)address + length;
+    if (last > MEMORY_SPACE) {
+        last = MEMORY_SPACE;
+    }
+
+    // "interpret" markers only depend on the one instruction at their address
+    for (uint32_t a = first; a < last; ++a) {
+        if (jit->blocks[a].kind == BLOCK_INTERPRET) {
+            jit->blocks[a].kind = BLOCK_NONE;
+        }
+    }
+
+    int hit = 0;
+    for (uint32_t a = address; a < last && !hit; ++a) {
+        hit = jit->covered[a];
+    }
+    if (!hit) {
+        return;
+    }
+
+    // drop overlapping blocks and rebuild the coverage map from the rest.
+    // the dead code stays in the buffer until the next flush
+    memset(jit->covered, 0, sizeof(jit->covered));
+    for (uint32_t start = 0; start < MEMORY_SPACE; ++start) {
+        jit_block *block = &jit->blocks[start];
+        if (block->kind != BLOCK_COMPILED) {
+            continue;
+        }
+        if (start < last && block->end > address) {
+            block->kind = BLOCK_NONE;
+        } else {
+            memset(&jit->covered[start], 1, block->end - start);
+        }
+    }
+}
+
+uint64_t jit_run(jit_context *jit, chip8_state *state, uint64_t max_cycles) {
+    uint64_t done = 0;
+
+    while (done < max_cycles) {
+        uint16_t pc = state->program_counter;
+
+        if (pc + 1 < MEMORY_SPACE) {
+            jit_block *block = &jit->blocks[pc];
+            if (block->kind == BLOCK_NONE) {
+                translate(jit, state, pc, block);
+            }
+            if (block->kind == BLOCK_COMPILED) {
+                uint64_t left = max_cycles - done;
+                done += block->code(state, left < block->length ? (uint32_t)left : block->length);
+                continue;
+            }
+        }
+
+        // No block here: interpret a stretch, then look again. Stores only
+        // ever happen in the interpreter, which notes where they landed.
+        uint64_t left = max_cycles - done;
+        uint64_t stretch = left < INTERPRET_STRETCH ? left : INTERPRET_STRETCH;
+        uint64_t ran = emu_run(state, stretch);
+        done += ran;
+        if (state->stored_high != 0) {
+            jit_invalidate(jit, state->stored_low, state->stored_high - state->stored_low);
+            state->stored_high = 0;
+        }
+
+        // a profiled call or return, for the caller to charge up to
+        if (ran < stretch) {
+            break;
+        }
+    }
+
+    return done;
+}
+
+#else // no recompiler for this host
+
+#include <stddef.h>
+
+jit_context *jit_create(void) {
+    return NULL;
+}
+
+void jit_destroy(jit_context *jit) {
+    (void)jit;
+}
+
+uint64_t jit_run(jit_context *jit, chip8_state *state, uint64_t max_cycles) {
+    (void)jit;
+    return emu_run(state, max_cycles);
+}
+
+void jit_invalidate(jit_context *jit, uint16_t address, uint16_t length) {
+    (void)jit;
+    (void)address;
+    (void)length;
+}
+
+void jit_flush(jit_context *jit) {
+    (void)jit;
+}
+
+#endif
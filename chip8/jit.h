@@ -0,0 +1,38 @@
+#ifndef JIT_H
+#define JIT_H
+#include <stdint.h>
+#include "state.h"
+
+/*
+Optional dynamic recompiler for x86-64.
+
+Straight-line runs of CHIP-8 instructions are translated into native basic
+blocks the first time they are reached. A block ends at a jump (1nnn, Bnnn)
+or a skip (3xkk, 4xkk, 5xy0, 9xy0), which it translates itself, or just
+before anything it can't translate (2nnn, 00EE, Dxyn, timers, keys, memory
+stores, ...). Those are run by emu_cycle, which stays the reference for what
+every instruction does. Inside a block the guest V registers and I live in
+host registers and are only written back on exit.
+
+On other hosts jit_create returns NULL and callers should stick to emu_cycle.
+*/
+
+typedef struct jit_context jit_context;
+
+// create a translation cache for one chip8_state, NULL if unsupported
+jit_context *jit_create(void);
+
+void jit_destroy(jit_context *jit);
+
+// Execute up to max_cycles instructions and return how many ran. Behaves
+// exactly like calling emu_cycle that many times. Like emu_run, stops early
+// after a call or return on a profiled state.
+uint64_t jit_run(jit_context *jit, chip8_state *state, uint64_t max_cycles);
+
+// drop translations covering memory[address, address + length)
+void jit_invalidate(jit_context *jit, uint16_t address, uint16_t length);
+
+// drop every translation, e.g. after memory was replaced wholesale
+void jit_flush(jit_context *jit);
+
+#endif // JIT_H
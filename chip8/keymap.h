@@ -1,8 +1,11 @@
+#ifndef KEYMAP_H
+#define KEYMAP_H
 #include <SDL2/SDL.h>
 #include <stdint.h>
 #include "state.h"
 
-const static uint8_t KEY_MAP[NUM_KEYS] = {
+// keyboard key for each keypad value
+static const SDL_Keycode KEY_MAP[NUM_KEYS] = {
     SDLK_x, // 0
     SDLK_1, // 1
     SDLK_2, // 2
@@ -19,4 +22,6 @@ const static uint8_t KEY_MAP[NUM_KEYS] = {
     SDLK_r, // D
     SDLK_f, // E
     SDLK_v  // F
-};
\ No newline at end of file
+};
+
+#endif // KEYMAP_H
@@ -1,48 +1,155 @@
 #include "loadROM.h"
 #include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// One cached ROM file. Several files with the same contents share one
+// mapping, the first one seen.
+typedef struct {
+    // which file, and the version of it that was mapped
+    dev_t device;
+    ino_t inode;
+    off_t size;
+    struct timespec modified;
+
+    uint64_t hash; // FNV-1a of the contents
+    uint8_t const *data; // read-only mapping, never unmapped
+} rom_cache_entry;
+
+// The cache assumes ROM files aren't rewritten in place while we run; a file
+// replaced by a new one (a new inode or mtime) is simply mapped again.
+
+static rom_cache_entry *rom_cache = NULL;
+static size_t rom_cache_count = 0;
+static size_t rom_cache_capacity = 0;
+static pthread_mutex_t rom_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+char const *rom_error_string(int error) {
+    switch (error) {
+        case ROM_OK:
+            return "ok";
+        case ROM_ERR_OPEN:
+            return "could not open ROM";
+        case ROM_ERR_SIZE:
+            return "ROM is empty or too big for memory";
+        case ROM_ERR_MAP:
+            return "could not map ROM";
+        default:
+            return "unknown error";
+    }
+}
+
+static uint64_t hash_bytes(uint8_t const *bytes, size_t size) {
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+static int same_file(rom_cache_entry const *entry, struct stat const *info) {
+    return entry->device == info->st_dev && entry->inode == info->st_ino
+        && entry->size == info->st_size
+        && entry->modified.tv_sec == info->st_mtim.tv_sec
+        && entry->modified.tv_nsec == info->st_mtim.tv_nsec;
+}
+
+// Open fileName as given, then under ./ROMs/. Returns the descriptor or -1.
+static int open_rom(char const *fileName) {
+    int fd = open(fileName, O_RDONLY);
+    if (fd >= 0) {
+        return fd;
+    }
 
-void loadROM(char *fileName, chip8_state *state) {
-    // get filepath
     char filePath[256];
     snprintf(filePath, sizeof(filePath), "./ROMs/%s", fileName);
+    return open(filePath, O_RDONLY);
+}
 
-    // open file as binary
-    FILE *fptr = fopen(filePath, "rb");
-    if (fptr == NULL) {
-        exit(0);
+// Find or add the cache entry for an open ROM file. Called with the lock held.
+static int cache_lookup(int fd, struct stat const *info, rom_cache_entry const **found) {
+    // seen this exact file before, nothing to read
+    for (size_t i = 0; i < rom_cache_count; ++i) {
+        if (same_file(&rom_cache[i], info)) {
+            *found = &rom_cache[i];
+            return ROM_OK;
+        }
     }
 
-    // move file pointer to the end, use ftell to get file size
-    fseek(fptr, 0, SEEK_END);
-    int size = ftell(fptr);
-    
-    // allocate buffer to store contents
-    char *buffer = malloc(size);
-    if (buffer == NULL) {
-        fclose(fptr);
-        exit(0);
+    if (rom_cache_count == rom_cache_capacity) {
+        size_t capacity = rom_cache_capacity ? rom_cache_capacity * 2 : 16;
+        rom_cache_entry *grown = realloc(rom_cache, capacity * sizeof(rom_cache_entry));
+        if (grown == NULL) {
+            return ROM_ERR_MAP;
+        }
+        rom_cache = grown;
+        rom_cache_capacity = capacity;
     }
 
-    // move file pointer back to start, load rom contents into state->memory
-    fseek(fptr, 0, SEEK_SET);
-    fread(buffer, 1, size, fptr);
-    memcpy(state->memory + PROGRAM_OFFSET, buffer, size);
+    size_t size = info->st_size;
+    uint8_t *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        return ROM_ERR_MAP;
+    }
+
+    rom_cache_entry *entry = &rom_cache[rom_cache_count];
+    entry->device = info->st_dev;
+    entry->inode = info->st_ino;
+    entry->size = info->st_size;
+    entry->modified = info->st_mtim;
+    entry->hash = hash_bytes(data, size);
+    entry->data = data;
 
-    // clean up
-    free(buffer);
-    fclose(fptr);
+    // another copy of a ROM we already have reuses that mapping
+    for (size_t i = 0; i < rom_cache_count; ++i) {
+        if (rom_cache[i].hash == entry->hash && rom_cache[i].size == entry->size
+            && memcmp(rom_cache[i].data, data, size) == 0) {
+            munmap(data, size);
+            entry->data = rom_cache[i].data;
+            break;
+        }
+    }
 
-    return;
+    ++rom_cache_count;
+    *found = entry;
+    return ROM_OK;
 }
 
-// void loadROM(const char *filename, chip8_state *state) {
-//     FILE *rom = fopen(filename, "rb");
-//     if (!rom) {
-//         fprintf(stderr, "Failed to open ROM: %s\n", filename);
-//         return -1;
-//     }
-
-//     fread(state->memory + PROGRAM_OFFSET, 1, MEMORY_SPACE - PROGRAM_OFFSET, rom);
-//     fclose(rom);
-//     return 0;
-// }
\ No newline at end of file
+int loadROM(char const *fileName, chip8_state *state) {
+    return loadROM_into(fileName, state->memory + PROGRAM_OFFSET, MAX_ROM_SIZE);
+}
+
+int loadROM_into(char const *fileName, uint8_t *dest, size_t capacity) {
+    int fd = open_rom(fileName);
+    if (fd < 0) {
+        return ROM_ERR_OPEN;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        close(fd);
+        return ROM_ERR_OPEN;
+    }
+    if (info.st_size <= 0 || (size_t)info.st_size > capacity) {
+        close(fd);
+        return ROM_ERR_SIZE;
+    }
+
+    pthread_mutex_lock(&rom_cache_lock);
+    rom_cache_entry const *entry = NULL;
+    int result = cache_lookup(fd, &info, &entry);
+    // entries can move when the cache grows, the mappings they point at don't
+    uint8_t const *data = result == ROM_OK ? entry->data : NULL;
+    pthread_mutex_unlock(&rom_cache_lock);
+
+    if (data != NULL) {
+        memcpy(dest, data, info.st_size);
+    }
+
+    close(fd);
+    return result;
+}
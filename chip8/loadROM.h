@@ -2,5 +2,27 @@
 #include <stdlib.h>
 #include "state.h"
 
-// loads a program (ROM) into the state
-void loadROM(char *fileName, chip8_state *state);
\ No newline at end of file
+// the largest program that fits between PROGRAM_OFFSET and the end of memory
+#define MAX_ROM_SIZE (MEMORY_SPACE - PROGRAM_OFFSET)
+
+// loadROM results
+#define ROM_OK 0
+#define ROM_ERR_OPEN -1 // not found, or couldn't be read
+#define ROM_ERR_SIZE -2 // empty, or bigger than memory has room for
+#define ROM_ERR_MAP -3 // mmap or the cache allocation failed
+
+// Loads a program (ROM) into the state at PROGRAM_OFFSET. fileName is tried
+// as given, then under ./ROMs/. Returns ROM_OK or one of the ROM_ERR_ codes.
+//
+// ROM files are mapped once and kept in a process-wide read-only cache keyed
+// by content hash, so loading the same ROM into many states (the batch
+// runner) costs a stat and one copy into memory each time. Safe to call from
+// several threads.
+int loadROM(char const *fileName, chip8_state *state);
+
+// Load a ROM of at most capacity bytes into dest, as loadROM does; for
+// machines with more memory than chip8_state has
+int loadROM_into(char const *fileName, uint8_t *dest, size_t capacity);
+
+// a short description of a loadROM result
+char const *rom_error_string(int error);
@@ -1,71 +1,463 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 #include <time.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include "state.h"
 #include "loadROM.h"
 #include "font.h"
 #include "cpu.h"
 #include "render_screen.h"
+#include "scheduler.h"
+#include "savestate.h"
+#include "rewind.h"
+#include "input_script.h"
+#include "input_queue.h"
+#include "triple_buffer.h"
+#include "profile.h"
+#include "stats.h"
+#include "xchip.h"
+#include "audio.h"
 
 #define VIDEO_WIDTH 64
 #define VIDEO_HEIGHT 32
 
+// rewind history: a keyframe a second, deltas in between. a few minutes of
+// typical play fit in 8 MB
+#define REWIND_ARENA_BYTES (8u << 20)
+#define REWIND_KEYFRAME_INTERVAL FRAME_RATE
+
+// fast-forward speed: frames emulated per frame shown while Tab is held, or
+// TURBO_UNLIMITED for as many as the host can run
+#define TURBO_UNLIMITED 0
+#define DEFAULT_TURBO TURBO_UNLIMITED
+
+// The emulator runs on its own thread, paced to 60 Hz, so a slow present or
+// a vsync stall on the render thread never delays it. Frames go to the
+// render thread through a triple buffer, input comes back through a queue.
+typedef struct {
+    // owned by the emulation thread while it runs
+    machine_type machine;
+    chip8_state state; // MACHINE_CHIP8
+    xchip_state xstate; // MACHINE_SCHIP and MACHINE_XOCHIP
+    int cycles_per_frame;
+    int turbo; // frames per pass while fast-forwarding, or TURBO_UNLIMITED
+    char const *state_path;
+    rewind_buffer *history;
+    input_recorder recorder;
+    bool recording;
+    uint64_t cycle;
+    char const *profile_path; // NULL unless profiling
+#ifdef CHIP8_STATS
+    char const *stats_path;
+#endif
+
+    // shared with the render thread, and the audio callback
+    triple_buffer frames;
+    audio_output audio;
+    input_queue input;
+    atomic_bool wake_pending; // a render_wake is queued and not yet handled
+    atomic_bool parked; // asleep until input arrives
+    atomic_bool quit;
+} emulator;
+
+// Wake the render thread for a new frame in the back slot
+static void publish_back(emulator *emu, uint64_t frame) {
+    triple_buffer_back(&emu->frames)->frame = frame;
+    triple_buffer_publish(&emu->frames);
+
+    // one wake at a time, the render thread always takes the newest frame
+    if (!atomic_exchange(&emu->wake_pending, true)) {
+        render_wake();
+    }
+}
+
+// Show the frame just emulated, if anything was drawn
+static void publish_frame(emulator *emu, uint64_t frame) {
+    if (emu->state.video_dirty == 0) {
+        return;
+    }
+    emu->state.video_dirty = 0;
+
+    memcpy(triple_buffer_back(&emu->frames)->video, emu->state.video, sizeof(emu->state.video));
+    publish_back(emu, frame);
+}
+
+// Whether a pass has emulated enough frames: one normally, and while
+// fast-forwarding emu->turbo of them, or with TURBO_UNLIMITED as many as fit
+// before the next frame is due. Only a pass's last frame is shown, and input
+// is only taken between passes, so the rest cost nothing but emulation.
+static bool pass_done(emulator const *emu, frame_scheduler const *sched, bool turbo, int frames) {
+    if (!turbo) {
+        return true;
+    }
+    if (emu->turbo == TURBO_UNLIMITED) {
+        return scheduler_due(sched);
+    }
+    return frames >= emu->turbo;
+}
+
+// The emulation thread for SUPER-CHIP and XO-CHIP: just the frame loop,
+// with the core picked once up front. Hotkeys other than fast-forward are
+// CHIP-8 only.
+static void *xchip_emulation_main(void *arg) {
+    emulator *emu = arg;
+    xchip_state *state = &emu->xstate;
+    xchip_run_fn run = xchip_core(emu->machine);
+    frame_scheduler sched;
+    scheduler_init(&sched, FRAME_RATE);
+    bool turbo = false;
+    uint64_t frame = 0;
+
+    while (!atomic_load(&emu->quit)) {
+        input_message message;
+        while (input_queue_pop(&emu->input, &message)) {
+            if (message.type == INPUT_KEYS) {
+                state->keys = message.keys;
+            } else if (message.type == INPUT_TURBO) {
+                turbo = message.down;
+            }
+        }
+
+        int frames = 0;
+        do {
+            run(state, emu->cycles_per_frame);
+            xchip_tick_timers(state);
+            ++frame;
+        } while (!pass_done(emu, &sched, turbo, ++frames));
+        audio_update(&emu->audio, state->sound_timer > 0, emu->machine == MACHINE_XOCHIP ? state->audio_pattern : NULL, state->pitch);
+
+        if (state->video_dirty) {
+            state->video_dirty = 0;
+            memcpy(triple_buffer_back(&emu->frames)->planes, state->video, sizeof(state->video));
+            publish_back(emu, frame);
+        }
+
+        scheduler_wait(&sched);
+    }
+    return NULL;
+}
+
+// Run a frame's cycles. A profiled run stops at every call and return for
+// its cycles to be charged, and is picked up again until the frame is done.
+static uint64_t run_frame(chip8_state *state, uint64_t cycles) {
+    uint64_t done = 0;
+    while (done < cycles) {
+        uint64_t ran = emu_run(state, cycles - done);
+        if (state->profile) {
+            profile_charge(state->profile, ran);
+        }
+        done += ran;
+    }
+    return done;
+}
+
+// The emulation thread, one pass per 60 Hz frame
+static void *emulation_main(void *arg) {
+    emulator *emu = arg;
+    chip8_state *state = &emu->state;
+    frame_scheduler sched;
+    scheduler_init(&sched, FRAME_RATE);
+    bool rewinding = false;
+    bool turbo = false;
+    uint64_t frame = 0;
+
+    while (!atomic_load(&emu->quit)) {
+        // Take the input that arrived since the last frame. Parked in Fx0A
+        // with the timers run down, nothing changes until a key goes down,
+        // so with no input sleep until there is some instead of idling
+        // through frames. The scheduler restarts its schedule on waking.
+        input_message message;
+        int got = input_queue_pop(&emu->input, &message);
+        if (!got && !rewinding && emu_waiting_for_key(state) && !state->delay_timer && !state->sound_timer) {
+            atomic_store(&emu->parked, true);
+            input_queue_wait(&emu->input);
+            atomic_store(&emu->parked, false);
+            continue;
+        }
+
+        bool save = false, load = false;
+        for (; got; got = input_queue_pop(&emu->input, &message)) {
+            switch (message.type) {
+                case INPUT_KEYS: state->keys = message.keys; break;
+                case INPUT_REWIND: rewinding = message.down; break;
+                case INPUT_TURBO: turbo = message.down; break;
+                case INPUT_SAVE_STATE: save = true; break;
+                case INPUT_LOAD_STATE: load = true; break;
+                case INPUT_QUIT: break;
+            }
+        }
+        if (emu->recording) {
+            input_recorder_update(&emu->recorder, state->keys, emu->cycle);
+        }
+
+        // F5 saves, F9 loads
+        if (save) {
+            savestate_save_file(state, emu->state_path);
+        }
+        if (load) {
+            if (emu->recording) {
+                fprintf(stderr, "Loading states is disabled while recording input\n");
+            } else {
+                savestate_load_file(state, emu->state_path);
+            }
+        }
+
+        if (rewinding && emu->history) {
+            // Step back a frame, keeping the keys that are really held
+            uint16_t held = state->keys;
+            rewind_step_back(emu->history, state);
+            state->keys = held;
+            ++frame;
+        } else {
+            // Execute a frame's worth of Chip-8 cycles, then tick the
+            // timers, for as many frames as the pass takes
+            int frames = 0;
+            do {
+                emu->cycle += run_frame(state, emu->cycles_per_frame);
+                emu_tick_timers(state);
+                if (emu->history) {
+                    rewind_push(emu->history, state);
+                }
+                ++frame;
+            } while (!pass_done(emu, &sched, turbo, ++frames));
+        }
+
+        audio_update(&emu->audio, state->sound_timer > 0, NULL, 0);
+        publish_frame(emu, frame);
+
+#ifdef CHIP8_STATS
+        if (state->stats && stats_dump_requested()) {
+            stats_save(state, emu->stats_path);
+            if (state->profile) {
+                profile_save_folded(state->profile, emu->profile_path);
+            }
+        }
+#endif
+
+        // Sleep until the next frame is due; an unlimited fast-forward pass
+        // ends when it is, so this returns straight away
+        scheduler_wait(&sched);
+    }
+    return NULL;
+}
+
+static void usage(char const *program) {
+    fprintf(stderr, "Usage: %s [-t <Turbo>] [-P] <Scale> <CyclesPerFrame> <ROM> [Seed] [InputLog]\n", program);
+}
+
 int main(int argc, char **argv) {
-    if (argc != 4) {
-        fprintf(stderr, "Usage: %s <Scale> <Delay> <ROM>\n", argv[0]);
+    // -t sets the fast-forward speed: 2 or more frames per frame shown, or
+    // 0 for unlimited. -P profiles guest subroutines into <ROM>.folded.
+    char const *program = argv[0];
+    int turbo = DEFAULT_TURBO;
+    bool profiling = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:P")) != -1) {
+        switch (opt) {
+            case 't':
+                turbo = atoi(optarg);
+                if (turbo != TURBO_UNLIMITED && turbo < 2) {
+                    fprintf(stderr, "Turbo must be 0 (unlimited) or at least 2, got %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'P':
+                profiling = true;
+                break;
+            default:
+                usage(program);
+                return EXIT_FAILURE;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+    if (argc < 4 || argc > 6) {
+        usage(program);
         return EXIT_FAILURE;
     }
     printf("yippee!\n");
 
     // Parse command line arguments
     int video_scale = atoi(argv[1]);
-    int cycle_delay = atoi(argv[2]);
+    int cycles_per_frame = atoi(argv[2]);
     char *rom_file_name = argv[3];
+    uint64_t seed = argc >= 5 ? strtoull(argv[4], NULL, 0) : (uint64_t)time(NULL);
+    char *input_log_path = argc == 6 ? argv[5] : NULL;
+    if (cycles_per_frame <= 0) {
+        cycles_per_frame = DEFAULT_CYCLES_PER_FRAME;
+    }
 
-    // Initialise Chip-8 state
-    chip8_state state;
-    initialise_state(&state);
-    loadROM(rom_file_name, &state);
+    // Initialise the machine the ROM is written for, going by its extension
+    static emulator emu;
+    chip8_state *state = &emu.state;
+    emu.machine = machine_from_rom(rom_file_name);
+    bool extended = emu.machine != MACHINE_CHIP8;
+    int rom_error;
+    if (extended) {
+        xchip_initialise(&emu.xstate, emu.machine, seed);
+        rom_error = xchip_load_rom(rom_file_name, &emu.xstate);
+    } else {
+        initialise_state(state, seed);
+        rom_error = loadROM(rom_file_name, state);
+    }
+    if (rom_error != ROM_OK) {
+        fprintf(stderr, "Failed to load %s: %s\n", rom_file_name, rom_error_string(rom_error));
+        return EXIT_FAILURE;
+    }
+    emu.cycles_per_frame = cycles_per_frame;
+    emu.turbo = turbo;
+    if (extended && input_log_path != NULL) {
+        fprintf(stderr, "Input logs are CHIP-8 only, not for %s\n", machine_name(emu.machine));
+        return EXIT_FAILURE;
+    }
+    if (extended && profiling) {
+        fprintf(stderr, "Profiling is CHIP-8 only, not for %s\n", machine_name(emu.machine));
+        return EXIT_FAILURE;
+    }
 
-    // Initialise SDL for rendering
+    // Initialise SDL for rendering. The extended machines' 128x64 texture
+    // is stretched over the same window.
     RenderContext renderCtx;
     int scaled_width = VIDEO_WIDTH * video_scale;
     int scaled_height = VIDEO_HEIGHT * video_scale;
-    if (render_initialise(&renderCtx, "CHIP-8 Emulator", scaled_width, scaled_height, VIDEO_WIDTH, VIDEO_HEIGHT) != 0) {
+    int texture_width = extended ? XCHIP_VIDEO_COLS : VIDEO_WIDTH;
+    int texture_height = extended ? XCHIP_VIDEO_ROWS : VIDEO_HEIGHT;
+    if (render_initialise(&renderCtx, "CHIP-8 Emulator", scaled_width, scaled_height, texture_width, texture_height) != 0) {
         fprintf(stderr, "Failed to initialise rendering context\n");
         return EXIT_FAILURE;
     }
 
-    // Main loop variables
-    bool quit = false;
-    uint32_t video_pitch = sizeof(state.video[0]) * VIDEO_WIDTH;
-    clock_t last_cycle_time = clock();
+    // Sound is optional, without a device we just run silent
+    audio_open(&emu.audio);
 
-    // Main loop
-    while (!quit) {
-        // Process input
-        quit = render_process_input(state.keys);
+    char state_path[256];
+    snprintf(state_path, sizeof(state_path), "%s.state", rom_file_name);
+    emu.state_path = state_path;
 
-        // Timing for the cycle delay
-        clock_t current_time = clock();
-        float dt = (float)(current_time - last_cycle_time) / CLOCKS_PER_SEC * 1000.0f; // Convert to milliseconds
+    // Rewind is always on for CHIP-8; if the buffer can't be allocated we
+    // just go without
+    emu.history = extended ? NULL : rewind_create(REWIND_ARENA_BYTES, REWIND_KEYFRAME_INTERVAL);
+    if (emu.history == NULL && !extended) {
+        fprintf(stderr, "Failed to allocate rewind buffer, rewind disabled\n");
+    }
 
-        if (dt > cycle_delay) {
-            last_cycle_time = current_time;
+    // The call tree goes to <rom>.folded at exit, and in stats builds on
+    // SIGUSR1 too
+    char profile_path[256];
+    snprintf(profile_path, sizeof(profile_path), "%s.folded", rom_file_name);
+    if (profiling) {
+        state->profile = profile_create();
+        emu.profile_path = profile_path;
+        if (state->profile == NULL) {
+            fprintf(stderr, "Failed to allocate the call tree, profiling disabled\n");
+        }
+    }
 
-            // Execute a Chip-8 cycle
-            emu_cycle(&state);
+#ifdef CHIP8_STATS
+    // Stats builds always count CHIP-8 runs, writing <rom>.stats.json at exit
+    // and on SIGUSR1
+    char stats_path[256];
+    snprintf(stats_path, sizeof(stats_path), "%s.stats.json", rom_file_name);
+    emu.stats_path = stats_path;
+    if (!extended) {
+        state->stats = stats_create();
+        stats_install_signal();
+    }
+#endif
 
-            // Update the rendering
-            render_update(&renderCtx, state.video, video_pitch);
+    // Record the session's key presses for replay with chip8_headless -i.
+    // A replay can't follow the machine jumping around in time, so rewind
+    // and loading states are off while recording.
+    if (input_log_path != NULL) {
+        if (input_recorder_open(&emu.recorder, input_log_path, cycles_per_frame, seed) != 0) {
+            audio_close(&emu.audio);
+            render_cleanup(&renderCtx);
+            return EXIT_FAILURE;
         }
+        emu.recording = true;
+        rewind_destroy(emu.history);
+        emu.history = NULL;
     }
 
+    // Start emulating
+    triple_buffer_init(&emu.frames);
+    pthread_t emulation_thread;
+    if (input_queue_init(&emu.input) != 0 || pthread_create(&emulation_thread, NULL, extended ? xchip_emulation_main : emulation_main, &emu) != 0) {
+        fprintf(stderr, "Failed to start the emulation thread\n");
+        audio_close(&emu.audio);
+        render_cleanup(&renderCtx);
+        return EXIT_FAILURE;
+    }
+
+    // This thread keeps SDL: it sleeps on SDL events, forwarding input and
+    // presenting each new frame the emulation thread wakes it for. While
+    // the emulator runs it also looks for a frame once per frame period, in
+    // case a wake was lost to a full SDL event queue; while it is parked
+    // waiting for a key, nothing can arrive without input first.
+    uint64_t shown[VIDEO_ROWS] = { 0 };
+    bool presented = false;
+    bool quit = false;
+    double frame_period = 1.0 / FRAME_RATE;
+    double next_frame = monotonic_seconds() + frame_period;
+    while (!quit) {
+        int timeout_ms = -1;
+        if (!atomic_load(&emu.parked)) {
+            double now = monotonic_seconds();
+            if (next_frame <= now) {
+                next_frame = now + frame_period;
+            }
+            timeout_ms = (int)((next_frame - now) * 1000.0) + 1;
+        }
+        quit = render_process_input(&renderCtx, &emu.input, timeout_ms);
+        atomic_store(&emu.wake_pending, false);
+
+        // Upload only the rows that differ from the last frame shown;
+        // frames skipped in between don't matter
+        video_frame const *frame = triple_buffer_acquire(&emu.frames);
+        if (frame != NULL && extended) {
+            render_update_planes(&renderCtx, frame->planes);
+        } else if (frame != NULL) {
+            uint32_t dirty = presented ? 0 : ALL_ROWS_DIRTY;
+            for (int row = 0; row < VIDEO_ROWS; ++row) {
+                if (frame->video[row] != shown[row]) {
+                    dirty |= 1u << row;
+                }
+            }
+            memcpy(shown, frame->video, sizeof(shown));
+            render_update(&renderCtx, frame->video, dirty);
+            presented = true;
+        }
+    }
+
+    // Stop the emulation thread, waking it if it's waiting for input
+    atomic_store(&emu.quit, true);
+    input_queue_push(&emu.input, INPUT_QUIT, 0, 0);
+    pthread_join(emulation_thread, NULL);
+    input_queue_destroy(&emu.input);
+
     // Clean up SDL resources
+    audio_close(&emu.audio);
     render_cleanup(&renderCtx);
+    rewind_destroy(emu.history);
+    if (emu.recording && input_recorder_close(&emu.recorder, emu.cycle) != 0) {
+        fprintf(stderr, "Failed to write input log: %s\n", input_log_path);
+    }
+    if (state->profile) {
+        profile_save_folded(state->profile, profile_path);
+        profile_destroy(state->profile);
+    }
+#ifdef CHIP8_STATS
+    if (state->stats) {
+        stats_save(state, stats_path);
+        stats_destroy(state->stats);
+    }
+#endif
 
     return 0;
 }
@@ -0,0 +1,131 @@
+#include <stdlib.h>
+
+#include "profile.h"
+
+// doubled as needed, up to CALL_TREE_MAX_NODES exactly
+#define CALL_TREE_INITIAL_NODES 64
+
+chip8_profile *profile_create(void) {
+    chip8_profile *profile = calloc(1, sizeof(chip8_profile));
+    if (profile == NULL) {
+        return NULL;
+    }
+    profile->calls = calloc(CALL_TREE_INITIAL_NODES, sizeof(call_node));
+    if (profile->calls == NULL) {
+        free(profile);
+        return NULL;
+    }
+    profile->capacity = CALL_TREE_INITIAL_NODES;
+    profile->num_calls = 1;
+    return profile;
+}
+
+void profile_destroy(chip8_profile *profile) {
+    if (profile != NULL) {
+        free(profile->calls);
+    }
+    free(profile);
+}
+
+void profile_call(chip8_profile *profile, uint16_t entry) {
+    profile->pending = PROFILE_CALL;
+    profile->pending_entry = entry;
+}
+
+void profile_return(chip8_profile *profile) {
+    profile->pending = PROFILE_RETURN;
+}
+
+// The current node's child for entry, added if it's new. Returns 0 if the
+// tree is full.
+static uint32_t child_call(chip8_profile *profile, uint16_t entry) {
+    call_node *calls = profile->calls;
+    uint32_t parent = profile->current;
+    for (uint32_t child = calls[parent].first_child; child != 0; child = calls[child].next_sibling) {
+        if (calls[child].entry == entry) {
+            return child;
+        }
+    }
+
+    if (profile->num_calls == profile->capacity) {
+        if (profile->capacity == CALL_TREE_MAX_NODES) {
+            return 0;
+        }
+        call_node *grown = realloc(calls, 2 * profile->capacity * sizeof(call_node));
+        if (grown == NULL) {
+            return 0;
+        }
+        profile->calls = calls = grown;
+        profile->capacity *= 2;
+    }
+    uint32_t child = profile->num_calls++;
+    calls[child] = (call_node){ .entry = entry, .parent = parent, .next_sibling = calls[parent].first_child };
+    calls[parent].first_child = child;
+    return child;
+}
+
+static void enter_call(chip8_profile *profile, uint16_t entry) {
+    uint32_t child = 0;
+    if (profile->lost_calls == 0 && profile->depth < CALL_TREE_MAX_DEPTH) {
+        child = child_call(profile, entry);
+    }
+    if (child == 0) {
+        ++profile->lost_calls;
+        return;
+    }
+    profile->current = child;
+    ++profile->depth;
+}
+
+static void leave_call(chip8_profile *profile) {
+    // a return with no call to match, e.g. after loading a state, is ignored
+    if (profile->lost_calls > 0) {
+        --profile->lost_calls;
+        return;
+    }
+    if (profile->depth == 0) {
+        return;
+    }
+    profile->current = profile->calls[profile->current].parent;
+    --profile->depth;
+}
+
+void profile_charge(chip8_profile *profile, uint64_t cycles) {
+    profile->calls[profile->current].cycles += cycles;
+    if (profile->pending == PROFILE_CALL) {
+        enter_call(profile, profile->pending_entry);
+    } else if (profile->pending == PROFILE_RETURN) {
+        leave_call(profile);
+    }
+    profile->pending = PROFILE_NONE;
+}
+
+void profile_write_folded(chip8_profile const *profile, FILE *out) {
+    // a node's path is read off walking up to the root, then written out
+    // from the root down
+    uint32_t path[CALL_TREE_MAX_DEPTH + 1];
+    for (uint32_t node = 0; node < profile->num_calls; ++node) {
+        if (profile->calls[node].cycles == 0) {
+            continue;
+        }
+        int depth = 0;
+        for (uint32_t up = node; up != 0; up = profile->calls[up].parent) {
+            path[depth++] = up;
+        }
+        fputs("main", out);
+        while (depth > 0) {
+            fprintf(out, ";sub_%03X", profile->calls[path[--depth]].entry);
+        }
+        fprintf(out, " %llu\n", (unsigned long long)profile->calls[node].cycles);
+    }
+}
+
+int profile_save_folded(chip8_profile const *profile, char const *path) {
+    FILE *fptr = fopen(path, "w");
+    if (fptr == NULL) {
+        fprintf(stderr, "Failed to open profile file: %s\n", path);
+        return -1;
+    }
+    profile_write_folded(profile, fptr);
+    return fclose(fptr) == 0 ? 0 : -1;
+}
@@ -0,0 +1,77 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+#include <stdint.h>
+#include <stdio.h>
+#include "state.h"
+
+/*
+A guest call tree, following 2nnn and 00EE: a node per subroutine entry
+address per chain of calls reaching it, with the instructions executed in it
+outside its callees. It is switched on per state by pointing state->profile
+at a chip8_profile, in any build.
+
+Nothing is counted per instruction. With a profile attached, emu_run ends
+its run just after a 2nnn or 00EE, and so does jit_run, which never compiles
+them. op_2nnn and op_00EE only note the call or return; the caller hands the
+cycles the run returned to profile_charge, which charges them to the node
+that ran them and then follows the noted call or return. Cutting runs at
+every call and return costs call-heavy code like Tetris about a tenth of its
+speed; unprofiled runs only test the pointer at calls and returns.
+*/
+
+// calls past these limits, e.g. recursion that never returns, are charged to
+// the node they were made from
+#define CALL_TREE_MAX_NODES 65536
+#define CALL_TREE_MAX_DEPTH 64
+
+// a subroutine as reached through one chain of calls; node 0 is the code
+// outside any call
+typedef struct {
+    uint16_t entry;
+    uint32_t parent;
+    uint32_t first_child;
+    uint32_t next_sibling;
+    uint64_t cycles; // instructions run here, not in callees
+} call_node;
+
+// what the last run ended on, for profile_charge to follow
+typedef enum {
+    PROFILE_NONE,
+    PROFILE_CALL,
+    PROFILE_RETURN,
+} profile_event;
+
+struct chip8_profile {
+    call_node *calls;
+    uint32_t num_calls;
+    uint32_t capacity;
+    uint32_t current; // the node running now
+    uint32_t depth;
+    uint32_t lost_calls; // calls past the limits not yet returned from
+    profile_event pending;
+    uint16_t pending_entry;
+};
+
+// an empty tree, NULL on allocation failure
+chip8_profile *profile_create(void);
+
+void profile_destroy(chip8_profile *profile);
+
+// a 2nnn to entry, and a 00EE, followed at the next profile_charge
+void profile_call(chip8_profile *profile, uint16_t entry);
+void profile_return(chip8_profile *profile);
+
+// Charge the cycles a run returned to the node running, then follow the
+// call or return the run ended on, if any. Call after every emu_run,
+// jit_run or emu_idle_frames on a profiled state.
+void profile_charge(chip8_profile *profile, uint64_t cycles);
+
+// Write the tree as folded stacks, one line per node that ran anything: its
+// chain of entry addresses from main down, and its instruction count, e.g.
+// "main;sub_2A4;sub_3F0 1234"
+void profile_write_folded(chip8_profile const *profile, FILE *out);
+
+// profile_write_folded to a file, returns 0 on success
+int profile_save_folded(chip8_profile const *profile, char const *path);
+
+#endif // PROFILE_H
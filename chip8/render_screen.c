@@ -1,4 +1,9 @@
 #include "render_screen.h"
+#include <string.h>
+#include "keymap.h"
+
+// user event posted by render_wake, registered in render_initialise
+static Uint32 wake_event = (Uint32)-1;
 
 // Initialise the SDL components
 int render_initialise(RenderContext *ctx, char const *title, int windowWidth, int windowHeight, int textureWidth, int textureHeight) {
@@ -28,76 +33,176 @@ int render_initialise(RenderContext *ctx, char const *title, int windowWidth, in
         return -1;
     }
 
+    // start black, so an expose before the first frame shows nothing
+    memset(ctx->pixels, 0, sizeof(ctx->pixels));
+    SDL_UpdateTexture(ctx->texture, NULL, ctx->pixels, sizeof(ctx->pixels[0]) * textureWidth);
+
+    wake_event = SDL_RegisterEvents(1);
+    ctx->keys = 0;
+    ctx->exposed = 0;
     return 0;
 }
 
-// Update the screen with the current buffer
-void render_update(RenderContext *ctx, void const *buffer, int pitch) {
-    SDL_UpdateTexture(ctx->texture, NULL, buffer, pitch);
+// Show the texture as it is
+static void present(RenderContext *ctx) {
     SDL_RenderClear(ctx->renderer);
     SDL_RenderCopy(ctx->renderer, ctx->texture, NULL, NULL);
     SDL_RenderPresent(ctx->renderer);
 }
 
-// Process input and update the keys array
-int render_process_input(uint8_t *keys) {
-    SDL_Event event;
-    int quit = 0;
+// Expand a run of 1-bit rows to RGBA and upload just those rows
+static void upload_rows(RenderContext *ctx, uint64_t const *video, int first, int count) {
+    for (int row = first; row < first + count; ++row) {
+        uint64_t bits = video[row];
+        uint32_t *out = &ctx->pixels[row * VIDEO_COLS];
+        for (int col = 0; col < VIDEO_COLS; ++col) {
+            out[col] = (bits >> (VIDEO_COLS - 1 - col)) & 1 ? 0xFFFFFFFF : 0;
+        }
+    }
 
-    while (SDL_PollEvent(&event)) {
-        switch (event.type) {
-            case SDL_QUIT:
-                quit = 1;
-                break;
+    SDL_Rect rect = { 0, first, VIDEO_COLS, count };
+    SDL_UpdateTexture(ctx->texture, &rect, &ctx->pixels[first * VIDEO_COLS], sizeof(ctx->pixels[0]) * VIDEO_COLS);
+}
 
-            case SDL_KEYDOWN:
-                switch (event.key.keysym.sym) {
-                    case SDLK_ESCAPE: quit = 1; break;
-                    case SDLK_x: keys[0] = 1; break;
-                    case SDLK_1: keys[1] = 1; break;
-                    case SDLK_2: keys[2] = 1; break;
-                    case SDLK_3: keys[3] = 1; break;
-                    case SDLK_q: keys[4] = 1; break;
-                    case SDLK_w: keys[5] = 1; break;
-                    case SDLK_e: keys[6] = 1; break;
-                    case SDLK_a: keys[7] = 1; break;
-                    case SDLK_s: keys[8] = 1; break;
-                    case SDLK_d: keys[9] = 1; break;
-                    case SDLK_z: keys[0xA] = 1; break;
-                    case SDLK_c: keys[0xB] = 1; break;
-                    case SDLK_4: keys[0xC] = 1; break;
-                    case SDLK_r: keys[0xD] = 1; break;
-                    case SDLK_f: keys[0xE] = 1; break;
-                    case SDLK_v: keys[0xF] = 1; break;
-                }
-                break;
+// Update the screen with the rows of the 1-bit framebuffer that changed
+void render_update(RenderContext *ctx, uint64_t const *video, uint32_t dirty) {
+    if (dirty == 0) {
+        return;
+    }
 
-            case SDL_KEYUP:
-                switch (event.key.keysym.sym) {
-                    case SDLK_x: keys[0] = 0; break;
-                    case SDLK_1: keys[1] = 0; break;
-                    case SDLK_2: keys[2] = 0; break;
-                    case SDLK_3: keys[3] = 0; break;
-                    case SDLK_q: keys[4] = 0; break;
-                    case SDLK_w: keys[5] = 0; break;
-                    case SDLK_e: keys[6] = 0; break;
-                    case SDLK_a: keys[7] = 0; break;
-                    case SDLK_s: keys[8] = 0; break;
-                    case SDLK_d: keys[9] = 0; break;
-                    case SDLK_z: keys[0xA] = 0; break;
-                    case SDLK_c: keys[0xB] = 0; break;
-                    case SDLK_4: keys[0xC] = 0; break;
-                    case SDLK_r: keys[0xD] = 0; break;
-                    case SDLK_f: keys[0xE] = 0; break;
-                    case SDLK_v: keys[0xF] = 0; break;
-                }
-                break;
+    // one texture update per contiguous run of dirty rows
+    int row = 0;
+    while (row < VIDEO_ROWS) {
+        if (!(dirty & (1u << row))) {
+            ++row;
+            continue;
+        }
+        int first = row;
+        while (row < VIDEO_ROWS && (dirty & (1u << row))) {
+            ++row;
         }
+        upload_rows(ctx, video, first, row - first);
     }
 
+    present(ctx);
+}
+
+// Colours for the extended machines' plane bits: background, plane 0 only,
+// plane 1 only, both. SUPER-CHIP only ever uses the first two.
+static const uint32_t PLANE_COLOURS[1 << XCHIP_PLANES] = { 0, 0xFFFFFFFF, 0xFF6600FF, 0x662200FF };
+
+void render_update_planes(RenderContext *ctx, uint64_t const planes[XCHIP_PLANES][XCHIP_VIDEO_ROWS][2]) {
+    for (int row = 0; row < XCHIP_VIDEO_ROWS; ++row) {
+        uint32_t *out = &ctx->pixels[row * XCHIP_VIDEO_COLS];
+        for (int col = 0; col < XCHIP_VIDEO_COLS; ++col) {
+            int shift = 63 - (col & 63);
+            int colour = (planes[0][row][col >> 6] >> shift & 1) | (planes[1][row][col >> 6] >> shift & 1) << 1;
+            out[col] = PLANE_COLOURS[colour];
+        }
+    }
+
+    SDL_UpdateTexture(ctx->texture, NULL, ctx->pixels, sizeof(ctx->pixels[0]) * XCHIP_VIDEO_COLS);
+    present(ctx);
+}
+
+// keypad value for a key, or -1 if it isn't on the keypad
+static int keypad_key(SDL_Keycode sym) {
+    for (int key = 0; key < NUM_KEYS; ++key) {
+        if (KEY_MAP[key] == sym) {
+            return key;
+        }
+    }
+    return -1;
+}
+
+// Handle one SDL event: keypad keys update ctx->keys, hotkeys go straight
+// to the emulation thread. Returns 1 on quit.
+static int handle_event(RenderContext *ctx, SDL_Event const *event, input_queue *queue) {
+    int down = event->type == SDL_KEYDOWN;
+    switch (event->type) {
+        case SDL_QUIT:
+            return 1;
+
+        // the texture still holds the last frame, it only needs showing
+        case SDL_WINDOWEVENT:
+            switch (event->window.event) {
+                case SDL_WINDOWEVENT_EXPOSED:
+                case SDL_WINDOWEVENT_SIZE_CHANGED:
+                case SDL_WINDOWEVENT_RESTORED:
+                    ctx->exposed = 1;
+                    break;
+            }
+            break;
+
+        case SDL_KEYDOWN:
+        case SDL_KEYUP:
+            // key repeat would only resend what the emulator already has
+            if (event->key.repeat) {
+                break;
+            }
+            switch (event->key.keysym.sym) {
+                case SDLK_ESCAPE:
+                    return down;
+                case SDLK_BACKSPACE:
+                    input_queue_push(queue, INPUT_REWIND, down, 0);
+                    break;
+                case SDLK_TAB:
+                    input_queue_push(queue, INPUT_TURBO, down, 0);
+                    break;
+                case SDLK_F5:
+                    if (down) {
+                        input_queue_push(queue, INPUT_SAVE_STATE, 1, 0);
+                    }
+                    break;
+                case SDLK_F9:
+                    if (down) {
+                        input_queue_push(queue, INPUT_LOAD_STATE, 1, 0);
+                    }
+                    break;
+                default: {
+                    int key = keypad_key(event->key.keysym.sym);
+                    if (key >= 0) {
+                        ctx->keys = (ctx->keys & ~(1u << key)) | (uint16_t)down << key;
+                    }
+                    break;
+                }
+            }
+            break;
+    }
+    return 0;
+}
+
+int render_process_input(RenderContext *ctx, input_queue *queue, int timeout_ms) {
+    SDL_Event event;
+    int got = timeout_ms < 0 ? SDL_WaitEvent(&event) : SDL_WaitEventTimeout(&event, timeout_ms);
+    if (!got) {
+        return 0;
+    }
+
+    uint16_t keys = ctx->keys;
+    int quit = handle_event(ctx, &event, queue);
+    while (SDL_PollEvent(&event)) {
+        quit |= handle_event(ctx, &event, queue);
+    }
+
+    // the whole keypad in one message, however many keys changed
+    if (ctx->keys != keys) {
+        input_queue_push(queue, INPUT_KEYS, 0, ctx->keys);
+    }
+
+    if (ctx->exposed) {
+        ctx->exposed = 0;
+        present(ctx);
+    }
     return quit;
 }
 
+void render_wake(void) {
+    SDL_Event event = { 0 };
+    event.type = wake_event;
+    SDL_PushEvent(&event);
+}
+
 void render_cleanup(RenderContext *ctx) {
     	SDL_DestroyTexture(ctx->texture);
 		SDL_DestroyRenderer(ctx->renderer);
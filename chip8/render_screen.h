@@ -1,16 +1,31 @@
 #include <SDL2/SDL.h>
 #include <stdint.h>
 #include "state.h"
+#include "xchip.h"
+#include "input_queue.h"
 
 // Structure to hold SDL components
 typedef struct {
     SDL_Window *window;
     SDL_Renderer *renderer;
     SDL_Texture *texture;
+    uint32_t pixels[XCHIP_VIDEO_ROWS * XCHIP_VIDEO_COLS]; // RGBA staging for the texture
+    uint16_t keys; // keypad bitmask, bit n set while key n is held
+    int exposed; // the window needs repainting, e.g. uncovered or resized
 } RenderContext;
 
 // Function declarations
 int render_initialise(RenderContext *ctx, char const *title, int windowWidth, int windowHeight, int textureWidth, int textureHeight);
-void render_update(RenderContext *ctx, void const *buffer, int pitch);
-int render_process_input(uint8_t *keys);
+// Upload the rows flagged in dirty and present; a no-op when dirty is 0
+void render_update(RenderContext *ctx, uint64_t const *video, uint32_t dirty);
+// Upload and present the two 128x64 planes of an extended machine, one
+// colour for each combination of plane bits
+void render_update_planes(RenderContext *ctx, uint64_t const planes[XCHIP_PLANES][XCHIP_VIDEO_ROWS][2]);
+// Wait up to timeout_ms (forever if negative) for SDL events, then forward
+// hotkeys and the keypad bitmask, if it changed, to the emulation thread.
+// A window that was uncovered or resized gets the last frame presented
+// again. Returns 1 when the window is closed or Escape pressed.
+int render_process_input(RenderContext *ctx, input_queue *queue, int timeout_ms);
+// Wake render_process_input from another thread, e.g. for a new frame
+void render_wake(void);
 void render_cleanup(RenderContext *ctx);
@@ -0,0 +1,239 @@
+#include "rewind.h"
+#include "savestate.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    size_t offset; // into the arena
+    size_t size;
+    int keyframe;
+} rewind_entry;
+
+struct rewind_buffer {
+    uint8_t *arena;
+    size_t arena_size;
+    size_t head; // where the next entry goes
+
+    rewind_entry *entries; // ring, oldest at first
+    size_t capacity;
+    size_t first;
+    size_t count;
+
+    uint32_t keyframe_interval;
+    uint32_t since_keyframe;
+
+    uint8_t newest[SAVESTATE_SIZE]; // decoded newest snapshot
+    uint8_t scratch[SAVESTATE_SIZE];
+};
+
+// Deltas are a sequence of (zero run, literal run, literal bytes) with both
+// runs as 16-bit little-endian counts. A delta is never bigger than this.
+#define MAX_DELTA_SIZE (SAVESTATE_SIZE + 4 * (SAVESTATE_SIZE / 2 + 1))
+
+static int same_word(uint8_t const *a, uint8_t const *b) {
+    uint64_t x, y;
+    memcpy(&x, a, sizeof(x));
+    memcpy(&y, b, sizeof(y));
+    return x == y;
+}
+
+static size_t delta_encode(uint8_t const *prev, uint8_t const *cur, uint8_t *out) {
+    size_t i = 0, n = 0;
+
+    while (i < SAVESTATE_SIZE) {
+        // skip unchanged bytes a word at a time, most of a frame is unchanged
+        size_t zeros = 0;
+        while (i + zeros + 8 <= SAVESTATE_SIZE && zeros + 8 <= 0xFFFF && same_word(prev + i + zeros, cur + i + zeros)) {
+            zeros += 8;
+        }
+        while (i + zeros < SAVESTATE_SIZE && prev[i + zeros] == cur[i + zeros] && zeros < 0xFFFF) {
+            ++zeros;
+        }
+        i += zeros;
+
+        // a literal run ends at the first pair of equal bytes, so a single
+        // matching byte doesn't cost a whole token
+        size_t literals = 0;
+        while (i + literals < SAVESTATE_SIZE && literals < 0xFFFF) {
+            size_t j = i + literals;
+            if (prev[j] == cur[j] && (j + 1 == SAVESTATE_SIZE || prev[j + 1] == cur[j + 1])) {
+                break;
+            }
+            ++literals;
+        }
+
+        out[n++] = zeros;
+        out[n++] = zeros >> 8;
+        out[n++] = literals;
+        out[n++] = literals >> 8;
+        for (size_t k = 0; k < literals; ++k) {
+            out[n++] = prev[i + k] ^ cur[i + k];
+        }
+        i += literals;
+    }
+    return n;
+}
+
+// XOR a delta into buf, turning one snapshot into its neighbour
+static void delta_apply(uint8_t *buf, uint8_t const *delta, size_t size) {
+    size_t i = 0, n = 0;
+
+    while (n < size) {
+        size_t zeros = delta[n] | delta[n + 1] << 8;
+        size_t literals = delta[n + 2] | delta[n + 3] << 8;
+        n += 4;
+        i += zeros;
+        for (size_t k = 0; k < literals; ++k) {
+            buf[i + k] ^= delta[n + k];
+        }
+        i += literals;
+        n += literals;
+    }
+}
+
+static rewind_entry *entry_at(rewind_buffer *rb, size_t index) {
+    return &rb->entries[(rb->first + index) % rb->capacity];
+}
+
+static void drop_oldest(rewind_buffer *rb) {
+    rb->first = (rb->first + 1) % rb->capacity;
+    --rb->count;
+}
+
+// Drop the oldest snapshot, and then any deltas that relied on it
+static void drop_oldest_group(rewind_buffer *rb) {
+    drop_oldest(rb);
+    while (rb->count > 0 && !entry_at(rb, 0)->keyframe) {
+        drop_oldest(rb);
+    }
+}
+
+rewind_buffer *rewind_create(size_t arena_bytes, uint32_t keyframe_interval) {
+    if (arena_bytes < 2 * MAX_DELTA_SIZE || keyframe_interval == 0) {
+        return NULL;
+    }
+
+    rewind_buffer *rb = calloc(1, sizeof(rewind_buffer));
+    if (rb == NULL) {
+        return NULL;
+    }
+    rb->arena = malloc(arena_bytes);
+    // every entry is at least one token, so this many always suffices
+    rb->capacity = arena_bytes / 4 + 1;
+    rb->entries = malloc(rb->capacity * sizeof(rewind_entry));
+    if (rb->arena == NULL || rb->entries == NULL) {
+        rewind_destroy(rb);
+        return NULL;
+    }
+    rb->arena_size = arena_bytes;
+    rb->keyframe_interval = keyframe_interval;
+    return rb;
+}
+
+void rewind_destroy(rewind_buffer *rb) {
+    if (rb == NULL) {
+        return;
+    }
+    free(rb->arena);
+    free(rb->entries);
+    free(rb);
+}
+
+// Reserve size contiguous bytes at the head of the arena, evicting the
+// oldest snapshots that are in the way
+static size_t arena_reserve(rewind_buffer *rb, size_t size) {
+    if (rb->head + size > rb->arena_size) {
+        // everything between the head and the end of the arena is older
+        // than anything before the head, so it goes first
+        while (rb->count > 0 && entry_at(rb, 0)->offset >= rb->head) {
+            drop_oldest_group(rb);
+        }
+        rb->head = 0;
+    }
+    size_t start = rb->head, end = rb->head + size;
+
+    while (rb->count > 0) {
+        rewind_entry const *oldest = entry_at(rb, 0);
+        if (oldest->offset >= end || oldest->offset + oldest->size <= start) {
+            break;
+        }
+        drop_oldest_group(rb);
+    }
+    rb->head = end;
+    return start;
+}
+
+int rewind_push(rewind_buffer *rb, chip8_state const *state) {
+    savestate_write(state, rb->scratch);
+
+    int keyframe = rb->count == 0 || rb->since_keyframe + 1 >= rb->keyframe_interval;
+    uint8_t delta[MAX_DELTA_SIZE];
+    uint8_t const *data = rb->scratch;
+    size_t size = SAVESTATE_SIZE;
+
+    if (!keyframe) {
+        size = delta_encode(rb->newest, rb->scratch, delta);
+        data = delta;
+    }
+
+    size_t offset = arena_reserve(rb, size);
+    // eviction may have taken everything, in which case a delta has no base
+    if (!keyframe && rb->count == 0) {
+        keyframe = 1;
+        size = SAVESTATE_SIZE;
+        data = rb->scratch;
+        offset = arena_reserve(rb, size);
+    }
+    memcpy(rb->arena + offset, data, size);
+
+    if (rb->count == rb->capacity) {
+        drop_oldest_group(rb);
+    }
+    rewind_entry *entry = entry_at(rb, rb->count++);
+    entry->offset = offset;
+    entry->size = size;
+    entry->keyframe = keyframe;
+
+    rb->since_keyframe = keyframe ? 0 : rb->since_keyframe + 1;
+    memcpy(rb->newest, rb->scratch, SAVESTATE_SIZE);
+    return 0;
+}
+
+int rewind_step_back(rewind_buffer *rb, chip8_state *state) {
+    if (rb->count < 2) {
+        return -1;
+    }
+
+    rewind_entry *dropped = entry_at(rb, rb->count - 1);
+    --rb->count;
+    rb->head = dropped->offset;
+
+    if (!dropped->keyframe) {
+        // the delta is newest XOR previous, so applying it steps back
+        delta_apply(rb->newest, rb->arena + dropped->offset, dropped->size);
+    } else {
+        // rebuild forward from the keyframe before it
+        size_t key = rb->count - 1;
+        while (!entry_at(rb, key)->keyframe) {
+            --key;
+        }
+        rewind_entry *entry = entry_at(rb, key);
+        memcpy(rb->newest, rb->arena + entry->offset, SAVESTATE_SIZE);
+        for (size_t i = key + 1; i < rb->count; ++i) {
+            entry = entry_at(rb, i);
+            delta_apply(rb->newest, rb->arena + entry->offset, entry->size);
+        }
+    }
+
+    // keyframe spacing restarts from whatever is now newest
+    rb->since_keyframe = 0;
+    for (size_t i = rb->count; i-- > 0 && !entry_at(rb, i)->keyframe;) {
+        ++rb->since_keyframe;
+    }
+
+    return savestate_read(state, rb->newest, SAVESTATE_SIZE);
+}
+
+size_t rewind_count(rewind_buffer const *rb) {
+    return rb->count;
+}
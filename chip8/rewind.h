@@ -0,0 +1,31 @@
+#ifndef REWIND_H
+#define REWIND_H
+#include <stddef.h>
+#include <stdint.h>
+#include "state.h"
+
+/*
+Rewind history: one snapshot per frame, kept in a fixed-size arena. Every
+keyframe_interval frames the full save state is stored; in between only the
+XOR against the previous snapshot is stored, run-length encoded, which for
+a typical frame is a few registers and a handful of video rows. When the
+arena fills, the oldest keyframe and its deltas are dropped together.
+*/
+
+typedef struct rewind_buffer rewind_buffer;
+
+rewind_buffer *rewind_create(size_t arena_bytes, uint32_t keyframe_interval);
+
+void rewind_destroy(rewind_buffer *rb);
+
+// record a snapshot, call once per frame. returns 0 on success
+int rewind_push(rewind_buffer *rb, chip8_state const *state);
+
+// Drop the newest snapshot and restore the one before it. Returns -1,
+// leaving state alone, if there is nothing older to go back to.
+int rewind_step_back(rewind_buffer *rb, chip8_state *state);
+
+// number of snapshots held
+size_t rewind_count(rewind_buffer const *rb);
+
+#endif // REWIND_H
@@ -0,0 +1,553 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "state.h"
+#include "loadROM.h"
+#include "cpu.h"
+#include "batch.h"
+#include "input_script.h"
+#include "jit.h"
+#include "scheduler.h"
+#include "threadpool.h"
+
+/*
+Runs a batch of jobs, each on its own chip8_state, spread across all cores.
+The job file has one job per line:
+
+    <ROM> <Cycles> [InputScript]
+
+Blank lines and lines starting with # are ignored. The input script can be a
+text script or a recorded binary log (see input_script.h); a log brings its
+own seed and cycles per frame. Results are printed in job file order once
+every job has finished.
+
+Once a job's script has no input left, it stops early if the program can't
+do anything new: it is jumping to itself, waiting for a key that will never
+come, or back in a state it was in at an earlier frame. The result says
+which, and the cycle it stopped at. -F runs every job to its budget anyway.
+
+-L runs jobs on the same ROM in lockstep, up to LOCKSTEP_LANES at a time
+on one worker (see batch.h), for many seeds or scripts of one ROM. Jobs
+stop early and end exactly as they would alone. A job that has gone its
+own way, getting fewer than LOCKSTEP_MIN_RUN instructions a round over
+LOCKSTEP_WINDOW_FRAMES frames, leaves the batch and runs to its end alone.
+*/
+
+#define MAX_PATH_LEN 256
+#define LOCKSTEP_LANES 256 // jobs per lockstep batch
+#define LOCKSTEP_WINDOW_FRAMES 32 // frames a lane's rounds are judged over
+#define LOCKSTEP_MIN_RUN 4 // instructions a round a lane needs to stay in lockstep
+
+typedef struct {
+    // job description
+    char rom[MAX_PATH_LEN];
+    char script[MAX_PATH_LEN]; // empty for no input
+    uint64_t cycle_budget;
+
+    // results
+    int status;
+    uint64_t cycles;
+    char const *halted; // why the job stopped before its budget, NULL if it didn't
+    uint64_t video_hash;
+    uint8_t v_register[NUM_V_REG];
+    uint16_t index_register;
+    uint16_t program_counter;
+    uint8_t stack_pointer;
+} runner_job;
+
+typedef struct {
+    runner_job *jobs;
+    size_t count;
+    uint64_t cycles_per_frame;
+    uint64_t seed;
+    int use_jit;
+    int run_full; // -F, no stopping early
+
+    // -L: jobs grouped by ROM, batch n is lockstep_order[lockstep_start[n], lockstep_start[n + 1])
+    runner_job **lockstep_order;
+    size_t *lockstep_start;
+    size_t num_lockstep;
+} job_list;
+
+// Brent's cycle finding over the state hash at each frame: every frame is
+// compared against one saved hash, which is re-taken at doubling distances,
+// so a loop of any length is found within a few times its length plus the
+// frames before it started, in constant space
+typedef struct {
+    uint64_t saved;
+    uint64_t since_saved; // frames
+    uint64_t distance; // frames to the next re-take, 0 before the first
+} halt_detector;
+
+static void usage(char const *prog) {
+    fprintf(stderr, "Usage: %s [-j <Threads>] [-p <CyclesPerFrame>] [-s <Seed>] [-J] [-F] [-L] <JobFile>\n", prog);
+}
+
+// Called at each frame boundary once no input is left, with the PC, the
+// instruction there, the keys and emu_state_hash. Returns why the program
+// can't do anything new, or NULL if it still might.
+static char const *check_halted(uint16_t pc, uint16_t opcode, uint16_t keys, uint64_t hash, halt_detector *detector) {
+    if (opcode == (0x1000u | (pc & ADDRESS_MASK))) {
+        return "self_jump";
+    }
+    // as emu_waiting_for_key
+    if ((opcode & 0xF0FFu) == 0xF00Au && keys == 0) {
+        return "key_wait";
+    }
+
+    if (detector->distance > 0 && hash == detector->saved) {
+        return "repeat";
+    }
+    if (++detector->since_saved >= detector->distance) {
+        detector->saved = hash;
+        detector->since_saved = 0;
+        detector->distance = detector->distance ? 2 * detector->distance : 1;
+    }
+    return NULL;
+}
+
+// check_halted for a chip8_state
+static char const *check_state_halted(chip8_state const *state, halt_detector *detector) {
+    uint16_t pc = state->program_counter & ADDRESS_MASK;
+    uint16_t opcode = (state->memory[pc] << 8) | state->memory[(pc + 1) & ADDRESS_MASK];
+    return check_halted(pc, opcode, state->keys, emu_state_hash(state), detector);
+}
+
+static int load_jobs(char const *path, job_list *list) {
+    list->jobs = NULL;
+    list->count = 0;
+
+    FILE *fptr = fopen(path, "r");
+    if (fptr == NULL) {
+        fprintf(stderr, "Failed to open job file: %s\n", path);
+        return -1;
+    }
+
+    size_t capacity = 0;
+    char line[3 * MAX_PATH_LEN];
+    int line_number = 0;
+
+    while (fgets(line, sizeof(line), fptr)) {
+        ++line_number;
+        runner_job job;
+        memset(&job, 0, sizeof(job));
+
+        char *p = line;
+        while (*p == ' ' || *p == '\t') {
+            ++p;
+        }
+        if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0') {
+            continue;
+        }
+
+        unsigned long long budget;
+        int fields = sscanf(p, "%255s %llu %255s", job.rom, &budget, job.script);
+        if (fields < 2) {
+            fprintf(stderr, "%s:%d: expected <ROM> <Cycles> [InputScript]\n", path, line_number);
+            free(list->jobs);
+            fclose(fptr);
+            return -1;
+        }
+        job.cycle_budget = budget;
+
+        if (list->count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            runner_job *grown = realloc(list->jobs, capacity * sizeof(runner_job));
+            if (grown == NULL) {
+                free(list->jobs);
+                fclose(fptr);
+                return -1;
+            }
+            list->jobs = grown;
+        }
+        list->jobs[list->count++] = job;
+    }
+
+    fclose(fptr);
+    return 0;
+}
+
+// A job's seed and frame length, from its script's header if it has one
+static void job_timing(job_list const *list, input_script const *script, uint64_t *seed, uint64_t *cycles_per_frame) {
+    *seed = list->seed;
+    *cycles_per_frame = list->cycles_per_frame;
+    if (script->has_header) {
+        *seed = script->seed;
+        if (script->cycles_per_frame > 0) {
+            *cycles_per_frame = script->cycles_per_frame;
+        }
+    }
+}
+
+static void store_result(runner_job *job, chip8_state const *state, uint64_t cycles) {
+    job->cycles = cycles;
+    job->video_hash = hash_video(state);
+    memcpy(job->v_register, state->v_register, sizeof(job->v_register));
+    job->index_register = state->index_register;
+    job->program_counter = state->program_counter;
+    job->stack_pointer = state->stack_pointer;
+}
+
+// Run a job on from cycle, which starts a frame, to its budget or until it
+// halts, frame by frame with each split into chunks between input events.
+// Returns the cycle it stopped at.
+static uint64_t run_frames(job_list const *list, runner_job *job, chip8_state *state, jit_context *jit,
+                           input_script *script, halt_detector *detector, uint64_t cycles_per_frame,
+                           uint64_t cycle) {
+    while (cycle < job->cycle_budget) {
+        input_script_apply(script, &state->keys, cycle);
+        if (!list->run_full && input_script_next_cycle(script) == UINT64_MAX) {
+            job->halted = check_state_halted(state, detector);
+            if (job->halted != NULL) {
+                break;
+            }
+        }
+
+        // Parked on a key wait, skip whole frames up to the next input event
+        if (emu_waiting_for_key(state)) {
+            uint64_t until = input_script_next_cycle(script);
+            if (until > job->cycle_budget) {
+                until = job->cycle_budget;
+            }
+            uint64_t idle_frames = (until - cycle) / cycles_per_frame;
+            if (idle_frames > 0) {
+                emu_idle_frames(state, idle_frames, cycles_per_frame);
+                cycle += idle_frames * cycles_per_frame;
+                continue;
+            }
+        }
+
+        uint64_t frame_end = cycle + cycles_per_frame;
+        if (frame_end > job->cycle_budget) {
+            frame_end = job->cycle_budget;
+        }
+
+        while (cycle < frame_end) {
+            input_script_apply(script, &state->keys, cycle);
+
+            uint64_t chunk = frame_end - cycle;
+            uint64_t next_event = input_script_next_cycle(script);
+            if (next_event - cycle < chunk) {
+                chunk = next_event - cycle;
+            }
+            cycle += jit ? jit_run(jit, state, chunk) : emu_run(state, chunk);
+        }
+
+        if (cycle % cycles_per_frame == 0) {
+            emu_tick_timers(state);
+        }
+    }
+    return cycle;
+}
+
+// runs one job start to finish, called from the worker threads
+static void run_job(void *ctx, size_t index) {
+    job_list *list = ctx;
+    runner_job *job = &list->jobs[index];
+
+    input_script script = { 0 };
+    if (job->script[0] != '\0' && input_script_load(job->script, &script) != 0) {
+        job->status = -1;
+        return;
+    }
+
+    // a recorded log replays with the seed and frame length it was made with
+    uint64_t seed, cycles_per_frame;
+    job_timing(list, &script, &seed, &cycles_per_frame);
+
+    // too big for a worker thread's stack
+    chip8_state *state = aligned_alloc(64, sizeof(chip8_state));
+    if (state == NULL) {
+        input_script_free(&script);
+        job->status = -1;
+        return;
+    }
+    initialise_state(state, seed);
+    int rom_error = loadROM(job->rom, state);
+    if (rom_error != ROM_OK) {
+        fprintf(stderr, "Failed to load %s: %s\n", job->rom, rom_error_string(rom_error));
+        free(state);
+        input_script_free(&script);
+        job->status = -1;
+        return;
+    }
+    emu_rehash_memory(state);
+    jit_context *jit = list->use_jit ? jit_create() : NULL;
+
+    halt_detector detector = { 0 };
+    uint64_t cycle = run_frames(list, job, state, jit, &script, &detector, cycles_per_frame, 0);
+    store_result(job, state, cycle);
+
+    jit_destroy(jit);
+    free(state);
+    input_script_free(&script);
+}
+
+// by ROM, then by position in the job file
+static int compare_by_rom(void const *a, void const *b) {
+    runner_job const *x = *(runner_job *const *)a, *y = *(runner_job *const *)b;
+    int order = strcmp(x->rom, y->rom);
+    return order != 0 ? order : (x > y) - (x < y);
+}
+
+// Split the jobs into lockstep batches of up to LOCKSTEP_LANES with the same ROM
+static int plan_lockstep(job_list *list) {
+    list->lockstep_order = malloc((list->count + 1) * sizeof(runner_job *));
+    list->lockstep_start = malloc((list->count + 1) * sizeof(size_t));
+    if (list->lockstep_order == NULL || list->lockstep_start == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < list->count; ++i) {
+        list->lockstep_order[i] = &list->jobs[i];
+    }
+    qsort(list->lockstep_order, list->count, sizeof(runner_job *), compare_by_rom);
+
+    list->num_lockstep = 0;
+    for (size_t i = 0; i < list->count; ++i) {
+        size_t start = list->num_lockstep ? list->lockstep_start[list->num_lockstep - 1] : 0;
+        if (i == 0 || i - start == LOCKSTEP_LANES ||
+            strcmp(list->lockstep_order[i]->rom, list->lockstep_order[start]->rom) != 0) {
+            list->lockstep_start[list->num_lockstep++] = i;
+        }
+    }
+    list->lockstep_start[list->num_lockstep] = list->count;
+    return 0;
+}
+
+typedef struct {
+    input_script script;
+    uint64_t cycles_per_frame;
+    uint64_t cycle;
+    uint64_t frame_end;
+    halt_detector detector;
+    int finished; // its result is in, or its script failed to load
+
+    // the lane's instructions and the rounds it took them in, lately
+    uint64_t window_cycles;
+    uint64_t window_rounds;
+} lockstep_lane;
+
+// runs one lockstep batch start to finish, called from the worker threads
+static void run_lockstep(void *ctx, size_t index) {
+    job_list *list = ctx;
+    runner_job **job = &list->lockstep_order[list->lockstep_start[index]];
+    size_t lanes = list->lockstep_start[index + 1] - list->lockstep_start[index];
+
+    lockstep_lane *lane = calloc(lanes, sizeof(lockstep_lane));
+    uint64_t *seeds = calloc(lanes, sizeof(uint64_t));
+    uint32_t *cycles = calloc(lanes, sizeof(uint32_t));
+    chip8_state *state = aligned_alloc(64, sizeof(chip8_state));
+    chip8_batch *batch = NULL;
+    int failed = lane == NULL || seeds == NULL || cycles == NULL || state == NULL;
+
+    // a job whose script won't load fails alone, and its lane is never run
+    for (size_t l = 0; !failed && l < lanes; ++l) {
+        if (job[l]->script[0] != '\0' && input_script_load(job[l]->script, &lane[l].script) != 0) {
+            job[l]->status = -1;
+            lane[l].finished = 1;
+        }
+        job_timing(list, &lane[l].script, &seeds[l], &lane[l].cycles_per_frame);
+    }
+    if (!failed) {
+        batch = batch_create(lanes, seeds);
+        failed = batch == NULL;
+    }
+    if (!failed) {
+        char const *rom = job[0]->rom;
+        int rom_error = batch_load_rom(batch, rom);
+        if (rom_error != ROM_OK) {
+            fprintf(stderr, "Failed to load %s: %s\n", rom, rom_error_string(rom_error));
+            failed = 1;
+        }
+    }
+
+    // Each pass gives every lane the cycles up to its next input event or
+    // the end of its frame, so lanes with the same frame length keep in step
+    int running = !failed;
+    while (running) {
+        running = 0;
+        for (size_t l = 0; l < lanes; ++l) {
+            lockstep_lane *ln = &lane[l];
+            uint64_t budget = job[l]->cycle_budget;
+            cycles[l] = 0;
+            if (ln->finished || ln->cycle >= budget) {
+                continue;
+            }
+            input_script_apply(&ln->script, batch_keys(batch, l), ln->cycle);
+            if (ln->cycle == ln->frame_end) {
+                // as run_frames, stop at the start of a frame once nothing new can happen
+                if (!list->run_full && input_script_next_cycle(&ln->script) == UINT64_MAX) {
+                    job[l]->halted = check_halted(batch_program_counter(batch, l), batch_next_opcode(batch, l),
+                                                  *batch_keys(batch, l), batch_state_hash(batch, l), &ln->detector);
+                    if (job[l]->halted != NULL) {
+                        batch_export(batch, l, state);
+                        store_result(job[l], state, ln->cycle);
+                        ln->finished = 1;
+                        continue;
+                    }
+                }
+                ln->frame_end = ln->cycle + ln->cycles_per_frame;
+                if (ln->frame_end > budget) {
+                    ln->frame_end = budget;
+                }
+            }
+
+            uint64_t chunk = ln->frame_end - ln->cycle;
+            uint64_t next_event = input_script_next_cycle(&ln->script);
+            if (next_event - ln->cycle < chunk) {
+                chunk = next_event - ln->cycle;
+            }
+            cycles[l] = chunk < UINT32_MAX ? (uint32_t)chunk : UINT32_MAX;
+            running = 1;
+        }
+        if (!running) {
+            break;
+        }
+
+        batch_run(batch, cycles);
+        for (size_t l = 0; l < lanes; ++l) {
+            lockstep_lane *ln = &lane[l];
+            if (cycles[l] == 0) {
+                continue;
+            }
+            ln->cycle += cycles[l];
+            ln->window_cycles += cycles[l];
+            ln->window_rounds += batch_rounds(batch, l);
+            if (ln->cycle != ln->frame_end || ln->cycle % ln->cycles_per_frame != 0) {
+                continue;
+            }
+            batch_tick_timers(batch, l);
+
+            // A lane that has gone its own way only gets an instruction or
+            // two a round, and runs faster alone. It's run to its end there
+            // and then, as a state of its own each frame would be a cache miss.
+            if (ln->window_cycles >= LOCKSTEP_WINDOW_FRAMES * ln->cycles_per_frame) {
+                if (ln->window_rounds * LOCKSTEP_MIN_RUN > ln->window_cycles) {
+                    batch_export(batch, l, state);
+                    uint64_t cycle = run_frames(list, job[l], state, NULL, &ln->script, &ln->detector,
+                                                ln->cycles_per_frame, ln->cycle);
+                    store_result(job[l], state, cycle);
+                    ln->finished = 1;
+                }
+                ln->window_cycles = 0;
+                ln->window_rounds = 0;
+            }
+        }
+    }
+
+    for (size_t l = 0; l < lanes; ++l) {
+        if (failed) {
+            job[l]->status = -1;
+        } else if (!lane[l].finished) {
+            batch_export(batch, l, state);
+            store_result(job[l], state, lane[l].cycle);
+        }
+        if (lane != NULL) {
+            input_script_free(&lane[l].script);
+        }
+    }
+
+    batch_destroy(batch);
+    free(state);
+    free(cycles);
+    free(seeds);
+    free(lane);
+}
+
+static void print_result(size_t index, runner_job const *job) {
+    if (job->status != 0) {
+        printf("job %zu rom=%s status=error\n", index, job->rom);
+        return;
+    }
+
+    printf("job %zu rom=%s cycles=%llu", index, job->rom, (unsigned long long)job->cycles);
+    if (job->halted != NULL) {
+        printf(" halted=%s", job->halted);
+    }
+    printf(" hash=%016llx pc=%03X i=%03X sp=%u v=",
+           (unsigned long long)job->video_hash, job->program_counter,
+           job->index_register, job->stack_pointer);
+    for (int i = 0; i < NUM_V_REG; ++i) {
+        printf("%02X", job->v_register[i]);
+    }
+    printf("\n");
+}
+
+int main(int argc, char **argv) {
+    unsigned num_threads = threadpool_default_threads();
+    uint64_t cycles_per_frame = DEFAULT_CYCLES_PER_FRAME;
+    uint64_t seed = 0;
+    int use_jit = 0;
+    int run_full = 0;
+    int lockstep = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "j:p:s:JFL")) != -1) {
+        switch (opt) {
+            case 'j':
+                num_threads = atoi(optarg);
+                break;
+            case 'p':
+                cycles_per_frame = strtoull(optarg, NULL, 10);
+                break;
+            case 's':
+                seed = strtoull(optarg, NULL, 0);
+                break;
+            case 'J':
+                use_jit = 1;
+                break;
+            case 'F':
+                run_full = 1;
+                break;
+            case 'L':
+                lockstep = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1 || cycles_per_frame == 0 || (lockstep && use_jit)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    job_list list;
+    if (load_jobs(argv[optind], &list) != 0) {
+        return EXIT_FAILURE;
+    }
+    list.cycles_per_frame = cycles_per_frame;
+    list.seed = seed;
+    list.use_jit = use_jit;
+    list.run_full = run_full;
+    list.lockstep_order = NULL;
+    list.lockstep_start = NULL;
+    list.num_lockstep = 0;
+
+    int pool_error;
+    if (lockstep) {
+        pool_error = plan_lockstep(&list) != 0 ||
+            threadpool_run(list.num_lockstep, num_threads, run_lockstep, &list) != 0;
+    } else {
+        pool_error = threadpool_run(list.count, num_threads, run_job, &list) != 0;
+    }
+    free(list.lockstep_order);
+    free(list.lockstep_start);
+    if (pool_error) {
+        fprintf(stderr, "Failed to start worker threads\n");
+        free(list.jobs);
+        return EXIT_FAILURE;
+    }
+
+    int failed = 0;
+    for (size_t i = 0; i < list.count; ++i) {
+        print_result(i, &list.jobs[i]);
+        failed |= list.jobs[i].status != 0;
+    }
+
+    free(list.jobs);
+    return failed ? EXIT_FAILURE : 0;
+}
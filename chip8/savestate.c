@@ -0,0 +1,140 @@
+#include "savestate.h"
+#include "cpu.h"
+#include <stdio.h>
+#include <string.h>
+
+static const uint8_t MAGIC[4] = { 'C', '8', 'S', 'S' };
+
+static uint8_t *put16(uint8_t *p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    return p + 2;
+}
+
+static uint8_t *put32(uint8_t *p, uint32_t v) {
+    p = put16(p, v);
+    return put16(p, v >> 16);
+}
+
+static uint8_t *put64(uint8_t *p, uint64_t v) {
+    p = put32(p, v);
+    return put32(p, v >> 32);
+}
+
+static uint16_t get16(uint8_t const **p) {
+    uint16_t v = (*p)[0] | (*p)[1] << 8;
+    *p += 2;
+    return v;
+}
+
+static uint32_t get32(uint8_t const **p) {
+    uint32_t lo = get16(p);
+    return lo | (uint32_t)get16(p) << 16;
+}
+
+static uint64_t get64(uint8_t const **p) {
+    uint64_t lo = get32(p);
+    return lo | (uint64_t)get32(p) << 32;
+}
+
+void savestate_write(chip8_state const *state, uint8_t *buf) {
+    uint8_t *p = buf;
+
+    memcpy(p, MAGIC, sizeof(MAGIC));
+    p = put16(p + sizeof(MAGIC), SAVESTATE_VERSION);
+
+    memcpy(p, state->v_register, NUM_V_REG);
+    p += NUM_V_REG;
+    memcpy(p, state->memory, MEMORY_SPACE);
+    p += MEMORY_SPACE;
+    p = put16(p, state->index_register);
+    p = put16(p, state->program_counter);
+    for (int i = 0; i < STACK_DEPTH; ++i) {
+        p = put16(p, state->stack[i]);
+    }
+    *p++ = state->stack_pointer;
+    *p++ = state->delay_timer;
+    *p++ = state->sound_timer;
+    for (int i = 0; i < VIDEO_ROWS; ++i) {
+        p = put64(p, state->video[i]);
+    }
+    p = put16(p, state->keys);
+    p = put32(p, state->opcode);
+    put64(p, state->rng_state);
+}
+
+int savestate_read(chip8_state *state, uint8_t const *buf, size_t size) {
+    uint8_t const *p = buf;
+
+    if (size != SAVESTATE_SIZE || memcmp(p, MAGIC, sizeof(MAGIC)) != 0) {
+        return -1;
+    }
+    p += sizeof(MAGIC);
+    if (get16(&p) != SAVESTATE_VERSION) {
+        return -1;
+    }
+
+    memcpy(state->v_register, p, NUM_V_REG);
+    p += NUM_V_REG;
+    memcpy(state->memory, p, MEMORY_SPACE);
+    p += MEMORY_SPACE;
+    state->index_register = get16(&p);
+    state->program_counter = get16(&p);
+    for (int i = 0; i < STACK_DEPTH; ++i) {
+        state->stack[i] = get16(&p);
+    }
+    state->stack_pointer = *p++;
+    state->delay_timer = *p++;
+    state->sound_timer = *p++;
+    for (int i = 0; i < VIDEO_ROWS; ++i) {
+        state->video[i] = get64(&p);
+    }
+    state->keys = get16(&p);
+    state->opcode = get32(&p);
+    state->rng_state = get64(&p);
+    if (state->rng_state == 0) {
+        state->rng_state = 1;
+    }
+
+    // memory changed under the decode cache, and the whole screen is new
+    initialise_opcode_tables(state);
+    emu_rehash_memory(state);
+    state->video_dirty = ALL_ROWS_DIRTY;
+    return 0;
+}
+
+int savestate_save_file(chip8_state const *state, char const *path) {
+    uint8_t buf[SAVESTATE_SIZE];
+    savestate_write(state, buf);
+
+    FILE *fptr = fopen(path, "wb");
+    if (fptr == NULL) {
+        fprintf(stderr, "Failed to open save state for writing: %s\n", path);
+        return -1;
+    }
+    size_t written = fwrite(buf, 1, sizeof(buf), fptr);
+    if (fclose(fptr) != 0 || written != sizeof(buf)) {
+        fprintf(stderr, "Failed to write save state: %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+int savestate_load_file(chip8_state *state, char const *path) {
+    uint8_t buf[SAVESTATE_SIZE + 1];
+
+    FILE *fptr = fopen(path, "rb");
+    if (fptr == NULL) {
+        fprintf(stderr, "Failed to open save state: %s\n", path);
+        return -1;
+    }
+    // read one byte more than expected so a longer file is caught as bad
+    size_t size = fread(buf, 1, sizeof(buf), fptr);
+    fclose(fptr);
+
+    if (savestate_read(state, buf, size) != 0) {
+        fprintf(stderr, "Not a compatible save state: %s\n", path);
+        return -1;
+    }
+    return 0;
+}
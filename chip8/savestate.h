@@ -0,0 +1,31 @@
+#ifndef SAVESTATE_H
+#define SAVESTATE_H
+#include <stddef.h>
+#include <stdint.h>
+#include "state.h"
+
+/*
+Save states are the machine part of a chip8_state in a fixed little-endian
+layout, behind a magic number and a format version:
+
+    "C8SS" version:u16
+    v_register[16] memory[4096] index:u16 pc:u16 stack[16]:u16
+    sp:u8 delay:u8 sound:u8 video[32]:u64 keys:u16 opcode:u32 rng:u64
+
+The decode cache and dirty rows are not saved; they are rebuilt on load.
+*/
+
+#define SAVESTATE_VERSION 3
+#define SAVESTATE_SIZE (4 + 2 + NUM_V_REG + MEMORY_SPACE + 2 + 2 + 2 * STACK_DEPTH + 3 + 8 * VIDEO_ROWS + 2 + 4 + 8)
+
+// serialize into buf, which must hold SAVESTATE_SIZE bytes
+void savestate_write(chip8_state const *state, uint8_t *buf);
+
+// restore from a serialized state, returns 0 on success or -1 if buf isn't
+// a save state this build understands. state is untouched on failure.
+int savestate_read(chip8_state *state, uint8_t const *buf, size_t size);
+
+int savestate_save_file(chip8_state const *state, char const *path);
+int savestate_load_file(chip8_state *state, char const *path);
+
+#endif // SAVESTATE_H
@@ -0,0 +1,52 @@
+#include "scheduler.h"
+#include <errno.h>
+
+#define NS_PER_SEC 1000000000L
+
+static void timespec_add_ns(struct timespec *ts, long ns) {
+    ts->tv_nsec += ns;
+    while (ts->tv_nsec >= NS_PER_SEC) {
+        ts->tv_nsec -= NS_PER_SEC;
+        ++ts->tv_sec;
+    }
+}
+
+static int timespec_before(struct timespec const *a, struct timespec const *b) {
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+void scheduler_init(frame_scheduler *sched, int frame_rate) {
+    sched->frame_ns = NS_PER_SEC / frame_rate;
+    clock_gettime(CLOCK_MONOTONIC, &sched->next_frame);
+    timespec_add_ns(&sched->next_frame, sched->frame_ns);
+}
+
+void scheduler_wait(frame_scheduler *sched) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    struct timespec late_limit = sched->next_frame;
+    timespec_add_ns(&late_limit, sched->frame_ns);
+    if (timespec_before(&late_limit, &now)) {
+        sched->next_frame = now;
+        timespec_add_ns(&sched->next_frame, sched->frame_ns);
+        return;
+    }
+
+    // absolute deadline, so a signal waking us early just sleeps again
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &sched->next_frame, NULL) == EINTR) {
+    }
+    timespec_add_ns(&sched->next_frame, sched->frame_ns);
+}
+
+int scheduler_due(frame_scheduler const *sched) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return !timespec_before(&now, &sched->next_frame);
+}
+
+double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,32 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+#include <stdint.h>
+#include <time.h>
+
+// the CHIP-8 timers run at 60 Hz, and so does everything else frame-based
+#define FRAME_RATE 60
+
+// instructions per frame unless told otherwise, about 660 per second
+#define DEFAULT_CYCLES_PER_FRAME 11
+
+// Paces a loop to a fixed frame rate by sleeping on the monotonic clock
+typedef struct {
+    struct timespec next_frame; // deadline of the frame in progress
+    long frame_ns;
+} frame_scheduler;
+
+void scheduler_init(frame_scheduler *sched, int frame_rate);
+
+// Sleep until the end of the current frame. If we've fallen more than a
+// frame behind (stopped in a debugger, machine suspended) the schedule is
+// restarted from now rather than running frames back to back to catch up.
+void scheduler_wait(frame_scheduler *sched);
+
+// nonzero once the current frame is due to end, for fitting as much work
+// into a frame as it has time for
+int scheduler_due(frame_scheduler const *sched);
+
+// wall clock time in seconds, unaffected by system clock changes
+double monotonic_seconds(void);
+
+#endif // SCHEDULER_H
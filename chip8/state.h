@@ -23,25 +23,71 @@ then increment PC by 2.
 
 - An 8-bit delay timer. If timer value is 0, it stays at 0. If loaded with a value, it decrements at a rate of 60 Hz. 
 
-- An 8-bit sound timer. TODO: IMPLEMENT LATER
+- An 8-bit sound timer. It counts down at 60 Hz like the delay timer, and a tone plays while it is nonzero (see audio.h).
 
 - 16 input keys
 
-- 64x32 Monochrome Display Memory
+- 64x32 Monochrome Display Memory, stored a row per 64-bit word
 */
 
 // define some constants
 #define MEMORY_SPACE 4096
 #define NUM_V_REG 16
 #define STACK_DEPTH 16
-#define VIDEO_ROWS 64
-#define VIDEO_COLS 32
+#define VIDEO_ROWS 32
+#define VIDEO_COLS 64
 #define NUM_KEYS 16
 #define FONT_OFFSET 0x50
 #define PROGRAM_OFFSET 0x200
 
+// guest addresses, stack slots and key numbers wrap rather than index past
+// their arrays
+#define ADDRESS_MASK (MEMORY_SPACE - 1)
+#define STACK_MASK (STACK_DEPTH - 1)
+#define KEY_MASK (NUM_KEYS - 1)
+
+// the framebuffer packs each display row into one 64-bit word
+_Static_assert(VIDEO_COLS == 64, "a display row must fill one uint64_t");
+_Static_assert(VIDEO_ROWS <= 32, "video_dirty has a bit per display row");
+#define ALL_ROWS_DIRTY ((uint32_t)((1ull << VIDEO_ROWS) - 1))
+
 // Forward declaration of chip8_state
 typedef struct chip8_state chip8_state;
+typedef struct chip8_stats chip8_stats; // see stats.h
+typedef struct chip8_profile chip8_profile; // see profile.h
+
+// An instruction decoded once and cached by address, so the hot loop
+// doesn't re-decode it every time it runs.
+typedef struct decoded_instr decoded_instr;
+typedef void (*op_handler)(chip8_state *state, decoded_instr const *instr);
+
+// What emu_run dispatches on: one entry per handler, then the
+// superinstructions, each standing for the instruction at its address and
+// the one or two after it
+typedef enum {
+    OP_UNKNOWN, OP_00E0, OP_00EE, OP_1nnn, OP_2nnn, OP_3xkk, OP_4xkk, OP_5xy0,
+    OP_6xkk, OP_7xkk, OP_8xy0, OP_8xy1, OP_8xy2, OP_8xy3, OP_8xy4, OP_8xy5,
+    OP_8xy6, OP_8xy7, OP_8xyE, OP_9xy0, OP_Annn, OP_Bnnn, OP_Cxkk, OP_Dxyn,
+    OP_Ex9E, OP_ExA1, OP_Fx07, OP_Fx0A, OP_Fx15, OP_Fx18, OP_Fx1E, OP_Fx29,
+    OP_Fx33, OP_Fx55, OP_Fx65,
+    SUPER_6xkk_6xkk, SUPER_Annn_Dxyn, SUPER_Dxyn_7xkk, SUPER_3xkk_1nnn,
+    SUPER_7xkk_3xkk_1nnn, SUPER_Fx07_3xkk,
+    NUM_OPS
+} op_index;
+
+// the most instructions a superinstruction stands for
+#define SUPER_MAX_LENGTH 3
+
+struct decoded_instr {
+    op_handler handler; // NULL if this address hasn't been decoded yet
+    uint16_t opcode;
+    uint16_t nnn;
+    uint8_t x;
+    uint8_t y;
+    uint8_t kk;
+    uint8_t n;
+    uint8_t op; // op_index; handler alone if that's a superinstruction
+};
 
 struct chip8_state {
     // actual characteristics of the chip8 system
@@ -53,9 +99,23 @@ struct chip8_state {
     uint8_t stack_pointer;
     uint8_t delay_timer;
     uint8_t sound_timer;
-    uint32_t video[VIDEO_ROWS * VIDEO_COLS]; // use a 32 bit int to make using SDL easier
-    uint8_t keys[NUM_KEYS];
+    uint64_t video[VIDEO_ROWS]; // one bit per pixel, column 0 is the top bit of each row
+    uint16_t keys; // bit n set while key n is held
     uint32_t opcode; // an instruction
+    uint64_t rng_state; // xorshift64* state for Cxkk, never 0
+
+    // emulator bookkeeping, not part of the machine
+    uint32_t video_dirty; // bit per video row changed since the last present
+    uint64_t memory_hash; // kept up to date by every store, see emu_state_hash
+    uint16_t stored_low, stored_high; // memory[low, high) covers every store since high was last zeroed, for the recompiler
+    // Indexed by address. Aligned to a cache line so which entries straddle
+    // lines doesn't depend on where the state lands; heap states need
+    // aligned_alloc.
+    _Alignas(64) decoded_instr decode_cache[MEMORY_SPACE];
+    chip8_profile *profile; // call tree to follow, NULL to not profile
+#ifdef CHIP8_STATS
+    chip8_stats *stats; // counters to update, NULL to not count
+#endif
 };
 
 #endif // STATE_H
@@ -0,0 +1,125 @@
+#include <signal.h>
+#include <stdlib.h>
+
+#include "stats.h"
+
+// per_class is indexed by op_index. Stats builds never fuse, so the
+// superinstructions stay at zero.
+static const char *const CLASS_NAMES[NUM_OPS] = {
+    "unknown", "00E0", "00EE", "1nnn", "2nnn", "3xkk", "4xkk", "5xy0",
+    "6xkk", "7xkk", "8xy0", "8xy1", "8xy2", "8xy3", "8xy4", "8xy5",
+    "8xy6", "8xy7", "8xyE", "9xy0", "Annn", "Bnnn", "Cxkk", "Dxyn",
+    "Ex9E", "ExA1", "Fx07", "Fx0A", "Fx15", "Fx18", "Fx1E", "Fx29",
+    "Fx33", "Fx55", "Fx65",
+    "6xkk+6xkk", "Annn+Dxyn", "Dxyn+7xkk", "3xkk+1nnn",
+    "7xkk+3xkk+1nnn", "Fx07+3xkk",
+};
+
+static volatile sig_atomic_t dump_requested = 0;
+
+void stats_retire(chip8_state *state, uint16_t address, uint32_t length) {
+    chip8_stats *stats = state->stats;
+    for (uint32_t i = 0; i < length; ++i) {
+        uint16_t pc = (address + i) & ADDRESS_MASK;
+        uint64_t runs = stats->pending[pc];
+        if (runs != 0) {
+            stats->per_class[state->decode_cache[pc].op] += runs;
+            stats->per_pc[pc] += runs;
+            stats->pending[pc] = 0;
+        }
+    }
+}
+
+chip8_stats *stats_create(void) {
+    return calloc(1, sizeof(chip8_stats));
+}
+
+void stats_destroy(chip8_stats *stats) {
+    free(stats);
+}
+
+// for sorting PCs hottest first
+static chip8_stats const *sort_stats;
+
+static int compare_pc_counts(void const *a, void const *b) {
+    uint64_t count_a = sort_stats->per_pc[*(uint16_t const *)a];
+    uint64_t count_b = sort_stats->per_pc[*(uint16_t const *)b];
+    if (count_a != count_b) {
+        return count_a < count_b ? 1 : -1;
+    }
+    return *(uint16_t const *)a < *(uint16_t const *)b ? -1 : 1;
+}
+
+void stats_write_json(chip8_state *state, FILE *out) {
+    stats_retire(state, 0, MEMORY_SPACE);
+    chip8_stats const *stats = state->stats;
+
+    uint64_t total = 0;
+    for (int i = 0; i < NUM_OPS; ++i) {
+        total += stats->per_class[i];
+    }
+
+    fprintf(out, "{\n  \"instructions\": %llu,\n", (unsigned long long)total);
+    fprintf(out, "  \"sprite_pixels\": %llu,\n", (unsigned long long)stats->sprite_pixels);
+    fprintf(out, "  \"sprite_collisions\": %llu,\n", (unsigned long long)stats->sprite_collisions);
+    fprintf(out, "  \"key_wait_spins\": %llu,\n", (unsigned long long)stats->key_wait_spins);
+
+    fprintf(out, "  \"opcode_classes\": {");
+    char const *separator = "\n";
+    for (int i = 0; i < NUM_OPS; ++i) {
+        if (stats->per_class[i] != 0) {
+            fprintf(out, "%s    \"%s\": %llu", separator, CLASS_NAMES[i], (unsigned long long)stats->per_class[i]);
+            separator = ",\n";
+        }
+    }
+    fprintf(out, "\n  },\n");
+
+    // collect and sort the PCs that ran
+    uint16_t pcs[MEMORY_SPACE];
+    int num_pcs = 0;
+    for (int pc = 0; pc < MEMORY_SPACE; ++pc) {
+        if (stats->per_pc[pc] != 0) {
+            pcs[num_pcs++] = pc;
+        }
+    }
+    sort_stats = stats;
+    qsort(pcs, num_pcs, sizeof(pcs[0]), compare_pc_counts);
+
+    fprintf(out, "  \"hot_pcs\": [");
+    for (int i = 0; i < num_pcs; ++i) {
+        fprintf(out, "%s\n    { \"pc\": \"%03X\", \"count\": %llu }", i ? "," : "",
+                pcs[i], (unsigned long long)stats->per_pc[pcs[i]]);
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
+
+int stats_save(chip8_state *state, char const *path) {
+    FILE *fptr = fopen(path, "w");
+    if (fptr == NULL) {
+        fprintf(stderr, "Failed to open stats file: %s\n", path);
+        return -1;
+    }
+    stats_write_json(state, fptr);
+    return fclose(fptr) == 0 ? 0 : -1;
+}
+
+static void handle_sigusr1(int signum) {
+    (void)signum;
+    dump_requested = 1;
+}
+
+void stats_install_signal(void) {
+    struct sigaction action;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    action.sa_handler = handle_sigusr1;
+    sigaction(SIGUSR1, &action, NULL);
+}
+
+int stats_dump_requested(void) {
+    if (!dump_requested) {
+        return 0;
+    }
+    dump_requested = 0;
+    return 1;
+}
@@ -0,0 +1,85 @@
+#ifndef STATS_H
+#define STATS_H
+#include <stdint.h>
+#include <stdio.h>
+#include "state.h"
+
+/*
+Execution counters, only built with -DCHIP8_STATS (make STATS=1). Without it
+the STATS_* macros expand to nothing and chip8_state has no stats pointer, so
+normal builds pay nothing.
+
+Counting is switched on per state by pointing state->stats at a chip8_stats.
+To keep the hot path to a single increment, emu_cycle only counts runs of
+whatever is decoded at each PC. Those are added to the per-class and per-PC
+totals when the decode is dropped (the code was overwritten, or a save state
+loaded) and before export. Dxyn and Fx0A add their own counters. The
+recompiler would run blocks without counting them, so it is disabled in stats
+builds. The guest call tree is kept apart from these, in any build (see
+profile.h).
+*/
+
+struct chip8_stats {
+    uint64_t per_class[NUM_OPS]; // by op_index
+    uint64_t per_pc[MEMORY_SPACE];
+    uint64_t pending[MEMORY_SPACE]; // runs of the current decode at each PC not yet in the totals
+    uint64_t sprite_pixels; // sprite bits drawn by Dxyn, set or cleared
+    uint64_t sprite_collisions; // Dxyn draws that set VF
+    uint64_t key_wait_spins; // Fx0A executions that found no key down
+};
+
+// Fold the pending counts for decode_cache[address, address + length) into
+// the totals. Called before those cache entries are dropped.
+void stats_retire(chip8_state *state, uint16_t address, uint32_t length);
+
+// zeroed counters, NULL on allocation failure
+chip8_stats *stats_create(void);
+
+void stats_destroy(chip8_stats *stats);
+
+// Write state->stats as a JSON object, retiring all pending counts first.
+// PCs are listed hottest first and only if they ran at all.
+void stats_write_json(chip8_state *state, FILE *out);
+
+// stats_write_json to a file, returns 0 on success
+int stats_save(chip8_state *state, char const *path);
+
+// Have SIGUSR1 request a dump. The handler only sets a flag, callers poll it
+// between frames.
+void stats_install_signal(void);
+
+// returns 1 once per SIGUSR1 received since the last call
+int stats_dump_requested(void);
+
+#ifdef CHIP8_STATS
+// a run of the instruction in the decode cache at pc
+#define STATS_COUNT_INSTR(state, pc) do { \
+        if ((state)->stats) { \
+            ++(state)->stats->pending[pc]; \
+        } \
+    } while (0)
+// a run of an instruction that bypassed the decode cache
+#define STATS_COUNT_UNCACHED(state, op, pc) do { \
+        if ((state)->stats) { \
+            ++(state)->stats->per_class[op]; \
+            ++(state)->stats->per_pc[(pc) & ADDRESS_MASK]; \
+        } \
+    } while (0)
+#define STATS_RETIRE(state, address, length) do { \
+        if ((state)->stats) { \
+            stats_retire((state), (address), (length)); \
+        } \
+    } while (0)
+#define STATS_ADD(state, counter, amount) do { \
+        if ((state)->stats) { \
+            (state)->stats->counter += (amount); \
+        } \
+    } while (0)
+#else
+#define STATS_COUNT_INSTR(state, pc) ((void)0)
+#define STATS_COUNT_UNCACHED(state, op, pc) ((void)0)
+#define STATS_RETIRE(state, address, length) ((void)0)
+#define STATS_ADD(state, counter, amount) ((void)0)
+#endif
+
+#endif // STATS_H
@@ -0,0 +1,141 @@
+#include "threadpool.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// A worker's queue of task indices. The owner takes from the tail, thieves
+// take from the head. Jobs are whole emulator runs, so a mutex per deque is
+// nowhere near the bottleneck.
+typedef struct {
+    pthread_mutex_t lock;
+    size_t *items;
+    size_t head;
+    size_t tail;
+} work_deque;
+
+typedef struct {
+    work_deque *deques;
+    unsigned num_threads;
+    threadpool_task task;
+    void *ctx;
+} pool;
+
+typedef struct {
+    pool *pool;
+    unsigned id;
+} worker;
+
+static int deque_pop_back(work_deque *dq, size_t *out) {
+    int found = 0;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->head < dq->tail) {
+        *out = dq->items[--dq->tail];
+        found = 1;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+static int deque_steal_front(work_deque *dq, size_t *out) {
+    int found = 0;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->head < dq->tail) {
+        *out = dq->items[dq->head++];
+        found = 1;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+static void *worker_main(void *arg) {
+    worker *self = arg;
+    pool *p = self->pool;
+    size_t index;
+
+    for (;;) {
+        if (deque_pop_back(&p->deques[self->id], &index)) {
+            p->task(p->ctx, index);
+            continue;
+        }
+
+        // own deque is empty, try everyone else starting with our neighbour.
+        // no task is ever pushed after start-up, so one empty sweep means done
+        int stole = 0;
+        for (unsigned i = 1; i < p->num_threads && !stole; ++i) {
+            unsigned victim = (self->id + i) % p->num_threads;
+            stole = deque_steal_front(&p->deques[victim], &index);
+        }
+        if (!stole) {
+            break;
+        }
+        p->task(p->ctx, index);
+    }
+
+    return NULL;
+}
+
+unsigned threadpool_default_threads(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (unsigned)n : 1;
+}
+
+int threadpool_run(size_t num_tasks, unsigned num_threads, threadpool_task task, void *ctx) {
+    if (num_threads == 0) {
+        num_threads = 1;
+    }
+    if (num_threads > num_tasks && num_tasks > 0) {
+        num_threads = num_tasks;
+    }
+
+    pool p = { .num_threads = num_threads, .task = task, .ctx = ctx };
+    p.deques = calloc(num_threads, sizeof(work_deque));
+    worker *workers = calloc(num_threads, sizeof(worker));
+    pthread_t *threads = calloc(num_threads, sizeof(pthread_t));
+    size_t *items = malloc((num_tasks + 1) * sizeof(size_t));
+    if (p.deques == NULL || workers == NULL || threads == NULL || items == NULL) {
+        free(p.deques);
+        free(workers);
+        free(threads);
+        free(items);
+        return -1;
+    }
+
+    // deal tasks round-robin; each deque gets a contiguous slice of items
+    size_t offset = 0;
+    for (unsigned t = 0; t < num_threads; ++t) {
+        work_deque *dq = &p.deques[t];
+        pthread_mutex_init(&dq->lock, NULL);
+        dq->items = items + offset;
+        for (size_t i = t; i < num_tasks; i += num_threads) {
+            dq->items[dq->tail++] = i;
+        }
+        offset += dq->tail;
+    }
+
+    // the calling thread is worker 0
+    unsigned started = 1;
+    for (unsigned t = 0; t < num_threads; ++t) {
+        workers[t].pool = &p;
+        workers[t].id = t;
+    }
+    for (unsigned t = 1; t < num_threads; ++t) {
+        if (pthread_create(&threads[t], NULL, worker_main, &workers[t]) != 0) {
+            break;
+        }
+        ++started;
+    }
+    // threads that failed to start just get their deques stolen from
+    worker_main(&workers[0]);
+    for (unsigned t = 1; t < started; ++t) {
+        pthread_join(threads[t], NULL);
+    }
+
+    for (unsigned t = 0; t < num_threads; ++t) {
+        pthread_mutex_destroy(&p.deques[t].lock);
+    }
+    free(items);
+    free(threads);
+    free(workers);
+    free(p.deques);
+    return 0;
+}
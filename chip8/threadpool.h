@@ -0,0 +1,17 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+#include <stddef.h>
+
+// a task is called once for every index in [0, num_tasks)
+typedef void (*threadpool_task)(void *ctx, size_t index);
+
+// Run num_tasks tasks over num_threads workers and wait for all of them.
+// Tasks are dealt round-robin onto per-worker deques; a worker pops from the
+// back of its own deque and steals from the front of the others once it runs
+// dry, so long jobs don't leave cores idle. Returns 0 on success.
+int threadpool_run(size_t num_tasks, unsigned num_threads, threadpool_task task, void *ctx);
+
+// number of online cores, at least 1
+unsigned threadpool_default_threads(void);
+
+#endif // THREADPOOL_H
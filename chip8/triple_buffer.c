@@ -0,0 +1,33 @@
+#include "triple_buffer.h"
+#include <string.h>
+
+#define TRIPLE_BUFFER_FRESH 0x4
+#define TRIPLE_BUFFER_INDEX 0x3
+
+void triple_buffer_init(triple_buffer *tb) {
+    memset(tb->slots, 0, sizeof(tb->slots));
+    tb->back = 0;
+    atomic_init(&tb->middle, 1);
+    tb->front = 2;
+}
+
+video_frame *triple_buffer_back(triple_buffer *tb) {
+    return &tb->slots[tb->back];
+}
+
+void triple_buffer_publish(triple_buffer *tb) {
+    // release the frame just written, acquire whatever slot the reader left
+    uint8_t old = atomic_exchange_explicit(&tb->middle, tb->back | TRIPLE_BUFFER_FRESH, memory_order_acq_rel);
+    tb->back = old & TRIPLE_BUFFER_INDEX;
+}
+
+video_frame const *triple_buffer_acquire(triple_buffer *tb) {
+    if (!(atomic_load_explicit(&tb->middle, memory_order_relaxed) & TRIPLE_BUFFER_FRESH)) {
+        return NULL;
+    }
+
+    // only the writer sets FRESH, so it's still set and this takes the frame
+    uint8_t old = atomic_exchange_explicit(&tb->middle, tb->front, memory_order_acq_rel);
+    tb->front = old & TRIPLE_BUFFER_INDEX;
+    return &tb->slots[tb->front];
+}
@@ -0,0 +1,42 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+#include <stdatomic.h>
+#include <stdint.h>
+#include "state.h"
+#include "xchip.h"
+
+/*
+Hands finished frames from the emulation thread to the render thread
+without locks. Of the three slots the writer owns one (back), the reader
+owns one (front), and the third (middle) is swapped with either side by a
+single atomic exchange. Publishing never waits for the reader, and the
+reader always gets the newest frame; frames published faster than they are
+presented are simply replaced. One writer thread and one reader thread.
+*/
+
+typedef struct {
+    uint64_t video[VIDEO_ROWS];
+    uint64_t planes[XCHIP_PLANES][XCHIP_VIDEO_ROWS][2]; // SUPER-CHIP and XO-CHIP
+    uint64_t frame; // emulated frame number it was taken at
+} video_frame;
+
+typedef struct {
+    video_frame slots[3];
+    _Atomic uint8_t middle; // slot index, plus TRIPLE_BUFFER_FRESH if not yet read
+    uint8_t back;  // writer's slot
+    uint8_t front; // reader's slot
+} triple_buffer;
+
+void triple_buffer_init(triple_buffer *tb);
+
+// writer: the slot to fill with the next frame
+video_frame *triple_buffer_back(triple_buffer *tb);
+
+// writer: publish the back slot, taking the middle one as the new back
+void triple_buffer_publish(triple_buffer *tb);
+
+// reader: the newest published frame, or NULL if nothing has been published
+// since the last call. The frame stays valid until the next call.
+video_frame const *triple_buffer_acquire(triple_buffer *tb);
+
+#endif // TRIPLE_BUFFER_H
@@ -0,0 +1,224 @@
+#include "video_export.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "state.h"
+#include "scheduler.h"
+
+// frames queued for the writer, 64 KB of bitmaps, a power of two
+#define VIDEO_EXPORT_RING 256
+
+// Y4M is limited range, so white and black are Y 235 and 16 with no colour
+#define Y4M_WHITE 235
+#define Y4M_BLACK 16
+#define Y4M_NO_CHROMA 128
+
+struct video_export {
+    FILE *file;
+    video_format format;
+    int scale;
+    int width, height; // after scaling
+
+    // emulation side
+    int skip_duplicates;
+    int have_last;
+    uint64_t last[VIDEO_ROWS];
+
+    // writer side, one whole frame as written, header included
+    uint8_t *image;
+    size_t image_bytes;
+    uint8_t *pixels; // where the picture starts in image
+
+    // the ring, under lock
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    uint64_t ring[VIDEO_EXPORT_RING][VIDEO_ROWS];
+    size_t head; // frames queued
+    size_t tail; // frames taken by the writer
+    int closing;
+    int failed;
+    pthread_t thread;
+};
+
+// Expand a frame into image. Each row is built once and copied down for
+// the rest of its scale; for Y4M only the luma plane changes.
+static void expand_frame(video_export *out, uint64_t const *video) {
+    int scale = out->scale;
+    size_t pixel_bytes = out->format == VIDEO_RGBA ? 4 : 1;
+    size_t row_bytes = (size_t)out->width * pixel_bytes;
+
+    uint8_t *dst = out->pixels;
+    for (int row = 0; row < VIDEO_ROWS; ++row) {
+        uint64_t bits = video[row];
+        uint8_t *p = dst;
+        for (int col = 0; col < VIDEO_COLS; ++col) {
+            int on = (bits >> (VIDEO_COLS - 1 - col)) & 1;
+            if (out->format == VIDEO_RGBA) {
+                uint8_t value = on ? 0xFF : 0;
+                for (int i = 0; i < scale; ++i, p += 4) {
+                    p[0] = p[1] = p[2] = value;
+                    p[3] = 0xFF;
+                }
+            } else {
+                memset(p, on ? Y4M_WHITE : Y4M_BLACK, (size_t)scale);
+                p += scale;
+            }
+        }
+        for (int i = 1; i < scale; ++i) {
+            memcpy(dst + (size_t)i * row_bytes, dst, row_bytes);
+        }
+        dst += (size_t)scale * row_bytes;
+    }
+}
+
+// The writer thread: take a frame, expand it and write it, until closed
+// with nothing left queued or a write fails
+static void *writer_main(void *arg) {
+    video_export *out = arg;
+    uint64_t video[VIDEO_ROWS];
+
+    for (;;) {
+        pthread_mutex_lock(&out->lock);
+        while (out->head == out->tail && !out->closing) {
+            pthread_cond_wait(&out->not_empty, &out->lock);
+        }
+        if (out->head == out->tail) {
+            pthread_mutex_unlock(&out->lock);
+            break;
+        }
+        memcpy(video, out->ring[out->tail % VIDEO_EXPORT_RING], sizeof(video));
+        if (out->head - out->tail++ == VIDEO_EXPORT_RING) {
+            pthread_cond_signal(&out->not_full);
+        }
+        pthread_mutex_unlock(&out->lock);
+
+        expand_frame(out, video);
+        if (fwrite(out->image, 1, out->image_bytes, out->file) != out->image_bytes) {
+            pthread_mutex_lock(&out->lock);
+            out->failed = 1;
+            pthread_cond_signal(&out->not_full);
+            pthread_mutex_unlock(&out->lock);
+            break;
+        }
+    }
+    return NULL;
+}
+
+video_export *video_export_open(char const *path, video_format format, int scale, int skip_duplicates) {
+    if (scale < 1 || scale > VIDEO_EXPORT_MAX_SCALE) {
+        fprintf(stderr, "Video scale must be 1 to %d, got %d\n", VIDEO_EXPORT_MAX_SCALE, scale);
+        return NULL;
+    }
+
+    video_export *out = calloc(1, sizeof(*out));
+    if (out == NULL) {
+        return NULL;
+    }
+    out->format = format;
+    out->scale = scale;
+    out->width = VIDEO_COLS * scale;
+    out->height = VIDEO_ROWS * scale;
+    out->skip_duplicates = skip_duplicates;
+
+    // Lay out a whole Y4M frame: its marker, the luma plane, then both
+    // chroma planes, which never change
+    size_t picture = (size_t)out->width * (size_t)out->height;
+    char header[64];
+    int header_len = 0;
+    if (format == VIDEO_Y4M) {
+        header_len = snprintf(header, sizeof(header), "FRAME\n");
+        out->image_bytes = (size_t)header_len + picture + picture / 2;
+    } else {
+        out->image_bytes = picture * 4;
+    }
+    out->image = malloc(out->image_bytes);
+    if (out->image == NULL) {
+        free(out);
+        return NULL;
+    }
+    memcpy(out->image, header, (size_t)header_len);
+    out->pixels = out->image + header_len;
+    if (format == VIDEO_Y4M) {
+        memset(out->pixels + picture, Y4M_NO_CHROMA, picture / 2);
+    }
+
+    out->file = strcmp(path, "-") == 0 ? stdout : fopen(path, "wb");
+    if (out->file == NULL) {
+        perror(path);
+        free(out->image);
+        free(out);
+        return NULL;
+    }
+    if (format == VIDEO_Y4M) {
+        fprintf(out->file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", out->width, out->height, FRAME_RATE);
+    }
+
+    pthread_mutex_init(&out->lock, NULL);
+    pthread_cond_init(&out->not_empty, NULL);
+    pthread_cond_init(&out->not_full, NULL);
+    if (pthread_create(&out->thread, NULL, writer_main, out) != 0) {
+        fprintf(stderr, "Failed to start the video writer thread\n");
+        pthread_cond_destroy(&out->not_full);
+        pthread_cond_destroy(&out->not_empty);
+        pthread_mutex_destroy(&out->lock);
+        if (out->file != stdout) {
+            fclose(out->file);
+        }
+        free(out->image);
+        free(out);
+        return NULL;
+    }
+    return out;
+}
+
+int video_export_frame(video_export *out, uint64_t const *video) {
+    size_t bytes = VIDEO_ROWS * sizeof(*video);
+    if (out->skip_duplicates && out->have_last && memcmp(video, out->last, bytes) == 0) {
+        return 0;
+    }
+    memcpy(out->last, video, bytes);
+    out->have_last = 1;
+
+    // the writer only sleeps on an empty ring, so only then wake it
+    pthread_mutex_lock(&out->lock);
+    while (out->head - out->tail == VIDEO_EXPORT_RING && !out->failed) {
+        pthread_cond_wait(&out->not_full, &out->lock);
+    }
+    int failed = out->failed;
+    if (!failed) {
+        memcpy(out->ring[out->head % VIDEO_EXPORT_RING], video, bytes);
+        if (out->head++ == out->tail) {
+            pthread_cond_signal(&out->not_empty);
+        }
+    }
+    pthread_mutex_unlock(&out->lock);
+    return failed ? -1 : 0;
+}
+
+int video_export_close(video_export *out) {
+    pthread_mutex_lock(&out->lock);
+    out->closing = 1;
+    pthread_cond_signal(&out->not_empty);
+    pthread_mutex_unlock(&out->lock);
+    pthread_join(out->thread, NULL);
+
+    int failed = out->failed;
+    if (out->file == stdout) {
+        failed |= fflush(out->file) != 0;
+    } else {
+        failed |= fclose(out->file) != 0;
+    }
+    if (failed) {
+        fprintf(stderr, "Failed to write video\n");
+    }
+
+    pthread_cond_destroy(&out->not_full);
+    pthread_cond_destroy(&out->not_empty);
+    pthread_mutex_destroy(&out->lock);
+    free(out->image);
+    free(out);
+    return failed ? -1 : 0;
+}
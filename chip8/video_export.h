@@ -0,0 +1,43 @@
+#ifndef VIDEO_EXPORT_H
+#define VIDEO_EXPORT_H
+#include <stdint.h>
+
+/*
+Uncompressed video of a run, one picture per 60 Hz frame boundary, for
+turning input logs into replays on machines without a display. Each pixel
+becomes a scale x scale block, white on black, in one of two formats:
+
+    Y4M   YUV4MPEG2 4:2:0 at 60 fps, which ffmpeg and most players read
+          straight from a file or pipe
+    RGBA  bare 8-bit R, G, B, A bytes per pixel, rows top to bottom, with
+          no header; the reader is told the size and rate
+
+The emulator only copies each frame's 256-byte bitmap into a ring; a writer
+thread expands and writes them, so a slow disk or pipe costs emulation
+nothing until the ring is full. Then video_export_frame waits for room
+rather than drop a frame, as a replay has to be complete.
+*/
+
+typedef enum {
+    VIDEO_Y4M,
+    VIDEO_RGBA,
+} video_format;
+
+#define VIDEO_EXPORT_MAX_SCALE 32
+
+typedef struct video_export video_export;
+
+// Start writing to path, or standard output for "-". With skip_duplicates,
+// frames identical to the last one written are left out, which keeps file
+// sizes down but loses the timing. Returns NULL after reporting the error.
+video_export *video_export_open(char const *path, video_format format, int scale, int skip_duplicates);
+
+// Call at every frame boundary with the machine's video. Returns 0, or -1
+// once writing has failed.
+int video_export_frame(video_export *out, uint64_t const *video);
+
+// Write out the frames still queued, then close. Returns 0, or -1 if any
+// write failed.
+int video_export_close(video_export *out);
+
+#endif // VIDEO_EXPORT_H
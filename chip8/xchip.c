@@ -0,0 +1,111 @@
+#include "xchip.h"
+#include "alu.h"
+#include "loadROM.h"
+#include "font.h"
+#include "cpu.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// A display row as one 128-bit value, column 0 in the top bit
+typedef unsigned __int128 xchip_row;
+
+static inline xchip_row xchip_load_row(uint64_t const *words) {
+    return (xchip_row)words[0] << 64 | words[1];
+}
+
+static inline void xchip_store_row(uint64_t *words, xchip_row row) {
+    words[0] = row >> 64;
+    words[1] = (uint64_t)row;
+}
+
+// Each bit of a 16-bit sprite row twice over, for low resolution pixels
+static inline uint32_t xchip_double_bits(uint32_t bits) {
+    bits = (bits | bits << 8) & 0x00FF00FFu;
+    bits = (bits | bits << 4) & 0x0F0F0F0Fu;
+    bits = (bits | bits << 2) & 0x33333333u;
+    bits = (bits | bits << 1) & 0x55555555u;
+    return bits | bits << 1;
+}
+
+#define CORE(name) schip_##name
+#define CORE_XOCHIP 0
+#include "xchip_core.h"
+#undef CORE
+#undef CORE_XOCHIP
+
+#define CORE(name) xochip_##name
+#define CORE_XOCHIP 1
+#include "xchip_core.h"
+#undef CORE
+#undef CORE_XOCHIP
+
+void xchip_initialise(xchip_state *state, machine_type type, uint64_t seed) {
+    memset(state, 0, sizeof(*state));
+    state->type = type;
+    state->program_counter = PROGRAM_OFFSET;
+    state->rng_state = rng_seed(seed);
+    state->planes = 1;
+    state->video_dirty = 1;
+    load_fonts(state->memory);
+}
+
+int xchip_load_rom(char const *fileName, xchip_state *state) {
+    // SUPER-CHIP programs have to fit in 4 KB like CHIP-8 ones
+    size_t capacity = state->type == MACHINE_XOCHIP ? XCHIP_MAX_ROM_SIZE : MAX_ROM_SIZE;
+    return loadROM_into(fileName, state->memory + PROGRAM_OFFSET, capacity);
+}
+
+xchip_run_fn xchip_core(machine_type type) {
+    return type == MACHINE_XOCHIP ? xochip_run : schip_run;
+}
+
+void xchip_tick_timers(xchip_state *state) {
+    if (state->delay_timer > 0) {
+        --state->delay_timer;
+    }
+    if (state->sound_timer > 0) {
+        --state->sound_timer;
+    }
+}
+
+uint64_t xchip_hash_video(xchip_state const *state) {
+    // as hash_video, a 64-bit word at a time
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (int plane = 0; plane < XCHIP_PLANES; ++plane) {
+        for (int row = 0; row < XCHIP_VIDEO_ROWS; ++row) {
+            for (int word = 0; word < 2; ++word) {
+                hash = (hash ^ state->video[plane][row][word]) * 0xBF58476D1CE4E5B9ull;
+                hash ^= hash >> 31;
+            }
+        }
+    }
+    return hash;
+}
+
+static char const *const MACHINE_NAMES[] = { "chip8", "schip", "xochip" };
+
+int machine_from_name(char const *name) {
+    for (int type = MACHINE_CHIP8; type <= MACHINE_XOCHIP; ++type) {
+        if (strcmp(name, MACHINE_NAMES[type]) == 0) {
+            return type;
+        }
+    }
+    return -1;
+}
+
+machine_type machine_from_rom(char const *fileName) {
+    char const *extension = strrchr(fileName, '.');
+    if (extension != NULL && strcasecmp(extension, ".sc8") == 0) {
+        return MACHINE_SCHIP;
+    }
+    if (extension != NULL && strcasecmp(extension, ".xo8") == 0) {
+        return MACHINE_XOCHIP;
+    }
+    return MACHINE_CHIP8;
+}
+
+char const *machine_name(machine_type type) {
+    return MACHINE_NAMES[type];
+}
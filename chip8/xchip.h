@@ -0,0 +1,96 @@
+#ifndef XCHIP_H
+#define XCHIP_H
+#include <stdint.h>
+#include "state.h"
+
+/*
+The extended machines, SUPER-CHIP 1.1 and XO-CHIP, next to the plain
+CHIP-8 core in cpu.c rather than inside it. Both share one machine state
+sized for the larger of them:
+
+- 64 KB of memory. SUPER-CHIP programs only address the first 4 KB.
+- A 128x64 display, always stored at full resolution. In low resolution
+  each pixel is drawn as a 2x2 block, so the framebuffer never changes
+  shape. A row is two 64-bit words, column 0 in the top bit of the first.
+- Two bit planes for XO-CHIP's four colours. SUPER-CHIP draws in plane 0
+  only.
+- The RPL user flags, the XO-CHIP audio pattern and the pitch register.
+
+Each machine has its own core, compiled from the shared handlers in
+xchip_core.h with its opcodes and quirks fixed at compile time. Pick one
+with xchip_core() once at startup, so no per-instruction check decides
+which machine is running. Plain CHIP-8 keeps its own core, and this file
+doesn't touch it; the register arithmetic all of them share is in alu.h.
+*/
+
+#define XCHIP_MEMORY_SPACE 0x10000
+#define XCHIP_VIDEO_ROWS 64
+#define XCHIP_VIDEO_COLS 128
+#define XCHIP_PLANES 2
+#define XCHIP_NUM_FLAGS 16
+#define XCHIP_AUDIO_PATTERN 16 // bytes, one bit per sample
+
+// the largest program that fits between PROGRAM_OFFSET and the end of memory
+#define XCHIP_MAX_ROM_SIZE (XCHIP_MEMORY_SPACE - PROGRAM_OFFSET)
+
+typedef enum {
+    MACHINE_CHIP8,
+    MACHINE_SCHIP,
+    MACHINE_XOCHIP,
+} machine_type;
+
+typedef struct {
+    machine_type type;
+    uint8_t v_register[NUM_V_REG];
+    uint8_t memory[XCHIP_MEMORY_SPACE];
+    uint16_t index_register;
+    uint16_t program_counter;
+    uint16_t stack[STACK_DEPTH];
+    uint8_t stack_pointer;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint64_t video[XCHIP_PLANES][XCHIP_VIDEO_ROWS][2];
+    uint16_t keys; // bit n set while key n is held
+    uint32_t opcode; // the last instruction executed
+    uint64_t rng_state; // xorshift64* state for Cxkk, never 0
+
+    uint8_t hires; // 00FF sets, 00FE clears
+    uint8_t planes; // planes drawn, scrolled and cleared (Fn01), bit per plane
+    uint8_t flags[XCHIP_NUM_FLAGS]; // Fx75 / Fx85
+    uint8_t audio_pattern[XCHIP_AUDIO_PATTERN]; // F002
+    uint8_t pitch; // Fx3A
+
+    // emulator bookkeeping, not part of the machine
+    uint8_t video_dirty; // nonzero if the screen changed since last cleared
+} xchip_state;
+
+// runs cycles instructions, returns the number executed
+typedef uint64_t (*xchip_run_fn)(xchip_state *state, uint64_t cycles);
+
+// Reset to power-on for the given machine, fonts loaded and the random
+// number generator seeded as initialise_state does.
+void xchip_initialise(xchip_state *state, machine_type type, uint64_t seed);
+
+// Load a ROM at PROGRAM_OFFSET, returns ROM_OK or a ROM_ERR_ code (loadROM.h)
+int xchip_load_rom(char const *fileName, xchip_state *state);
+
+// The core for a machine, MACHINE_SCHIP or MACHINE_XOCHIP
+xchip_run_fn xchip_core(machine_type type);
+
+// count the timers down by one, once per 60 Hz frame
+void xchip_tick_timers(xchip_state *state);
+
+// 64-bit hash of both planes, for comparing runs
+uint64_t xchip_hash_video(xchip_state const *state);
+
+// Machine names as given on command lines: "chip8", "schip" or "xochip".
+// Returns -1 for anything else.
+int machine_from_name(char const *name);
+
+// The machine a ROM is written for, going by its file extension: .sc8 is
+// SUPER-CHIP, .xo8 XO-CHIP, and anything else plain CHIP-8.
+machine_type machine_from_rom(char const *fileName);
+
+char const *machine_name(machine_type type);
+
+#endif // XCHIP_H
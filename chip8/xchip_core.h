@@ -0,0 +1,423 @@
+/*
+One extended-machine interpreter core. Not a normal header: xchip.c
+includes it once per machine, defining first
+
+    CORE(name)   this machine's name for name, e.g. schip_##name
+    CORE_XOCHIP  1 for XO-CHIP, 0 for SUPER-CHIP
+
+so the handlers below are written once and compiled twice, each time with
+the machine's opcodes and quirks fixed. A core never checks at run time
+which machine it is.
+
+Quirks follow Octo's defaults for each machine:
+
+                        SUPER-CHIP      XO-CHIP
+    address space       4 KB            64 KB
+    8xy6 / 8xyE         shift Vx        shift Vy into Vx
+    Fx55 / Fx65         I unchanged     I moves past Vx
+    Bnnn                Bxnn, + Vx      + V0
+    sprites at edges    clipped         wrapped
+    Fx75 / Fx85 flags   8               16
+*/
+
+#if CORE_XOCHIP
+#define C_ADDRESS_MASK 0xFFFFu
+#define C_NUM_FLAGS 16
+#define C_SHIFT_VY 1
+#define C_LOAD_STORE_MOVES_I 1
+#define C_JUMP_VX 0
+#define C_WRAP_SPRITES 1
+#else
+#define C_ADDRESS_MASK 0x0FFFu
+#define C_NUM_FLAGS 8
+#define C_SHIFT_VY 0
+#define C_LOAD_STORE_MOVES_I 0
+#define C_JUMP_VX 1
+#define C_WRAP_SPRITES 0
+#endif
+
+#define C_MEM(state, address) ((state)->memory[(address) & C_ADDRESS_MASK])
+
+// Skip the next instruction. On XO-CHIP that may be the 4-byte F000 nnnn.
+static inline void CORE(skip)(xchip_state *state) {
+#if CORE_XOCHIP
+    if (C_MEM(state, state->program_counter) == 0xF0 && C_MEM(state, state->program_counter + 1) == 0x00) {
+        state->program_counter += 2;
+    }
+#endif
+    state->program_counter += 2;
+}
+
+// clear the selected planes
+static void CORE(clear)(xchip_state *state) {
+    for (int plane = 0; plane < XCHIP_PLANES; ++plane) {
+        if (state->planes & (1u << plane)) {
+            memset(state->video[plane], 0, sizeof(state->video[plane]));
+        }
+    }
+    state->video_dirty = 1;
+}
+
+// Scroll the selected planes down by rows, or up if negative. Distances
+// are in the current resolution, so low resolution moves twice as far.
+static void CORE(scroll_vertical)(xchip_state *state, int rows) {
+    if (!state->hires) {
+        rows *= 2;
+    }
+    for (int plane = 0; plane < XCHIP_PLANES; ++plane) {
+        if (!(state->planes & (1u << plane))) {
+            continue;
+        }
+        uint64_t (*video)[2] = state->video[plane];
+        if (rows > 0) {
+            memmove(video[rows], video[0], (XCHIP_VIDEO_ROWS - rows) * sizeof(video[0]));
+            memset(video[0], 0, rows * sizeof(video[0]));
+        } else {
+            memmove(video[0], video[-rows], (XCHIP_VIDEO_ROWS + rows) * sizeof(video[0]));
+            memset(video[XCHIP_VIDEO_ROWS + rows], 0, -rows * sizeof(video[0]));
+        }
+    }
+    state->video_dirty = 1;
+}
+
+// scroll the selected planes right by cols pixels, or left if negative
+static void CORE(scroll_horizontal)(xchip_state *state, int cols) {
+    if (!state->hires) {
+        cols *= 2;
+    }
+    for (int plane = 0; plane < XCHIP_PLANES; ++plane) {
+        if (!(state->planes & (1u << plane))) {
+            continue;
+        }
+        for (int row = 0; row < XCHIP_VIDEO_ROWS; ++row) {
+            xchip_row line = xchip_load_row(state->video[plane][row]);
+            line = cols > 0 ? line >> cols : line << -cols;
+            xchip_store_row(state->video[plane][row], line);
+        }
+    }
+    state->video_dirty = 1;
+}
+
+static void CORE(op_Dxyn)(xchip_state *state, uint8_t x, uint8_t y, uint8_t n) {
+    // Draw an 8xn sprite at (Vx, Vy), or a 16x16 one for n = 0, into each
+    // selected plane; with two selected the second plane's rows follow the
+    // first's. VF = 1 if any pixel was turned off.
+    int big = n == 0;
+    int height = big ? 16 : n;
+    int width = big ? 16 : 8;
+    int scale = state->hires ? 1 : 2;
+    unsigned int xPos = state->v_register[x] % (XCHIP_VIDEO_COLS / scale) * scale;
+    unsigned int yPos = state->v_register[y] % (XCHIP_VIDEO_ROWS / scale) * scale;
+    uint16_t address = state->index_register;
+    xchip_row collision = 0;
+
+    for (int plane = 0; plane < XCHIP_PLANES; ++plane) {
+        if (!(state->planes & (1u << plane))) {
+            continue;
+        }
+
+        for (int row = 0; row < height; ++row) {
+            uint32_t bits = C_MEM(state, address);
+            if (big) {
+                bits = bits << 8 | C_MEM(state, address + 1);
+            }
+            address += big ? 2 : 1;
+
+            // the row at column 0 of a 128-bit line, then moved into place
+            int row_width = width;
+            if (scale == 2) {
+                bits = xchip_double_bits(bits);
+                row_width *= 2;
+            }
+            xchip_row sprite = (xchip_row)bits << (XCHIP_VIDEO_COLS - row_width);
+            xchip_row line = sprite >> xPos;
+#if C_WRAP_SPRITES
+            if (xPos) {
+                line |= sprite << (XCHIP_VIDEO_COLS - xPos);
+            }
+#endif
+
+            for (int copy = 0; copy < scale; ++copy) {
+                unsigned int screen_row = yPos + row * scale + copy;
+#if C_WRAP_SPRITES
+                screen_row %= XCHIP_VIDEO_ROWS;
+#else
+                if (screen_row >= XCHIP_VIDEO_ROWS) {
+                    break;
+                }
+#endif
+                uint64_t *words = state->video[plane][screen_row];
+                xchip_row screen = xchip_load_row(words);
+                collision |= screen & line;
+                xchip_store_row(words, screen ^ line);
+            }
+        }
+    }
+
+    state->v_register[0xF] = collision != 0;
+    state->video_dirty = 1;
+}
+
+// 00__ opcodes
+static void CORE(op_00__)(xchip_state *state, uint16_t opcode) {
+    switch (opcode & 0x00F0u) {
+        case 0xC0:
+            // scroll down n rows
+            CORE(scroll_vertical)(state, opcode & 0xF);
+            return;
+#if CORE_XOCHIP
+        case 0xD0:
+            // scroll up n rows
+            CORE(scroll_vertical)(state, -(opcode & 0xF));
+            return;
+#endif
+    }
+
+    switch (opcode) {
+        case 0x00E0:
+            CORE(clear)(state);
+            break;
+        case 0x00EE:
+            --state->stack_pointer;
+            state->program_counter = state->stack[state->stack_pointer & STACK_MASK];
+            break;
+        case 0x00FB:
+            CORE(scroll_horizontal)(state, 4);
+            break;
+        case 0x00FC:
+            CORE(scroll_horizontal)(state, -4);
+            break;
+        case 0x00FD:
+            // exit: stay on this instruction from now on
+            state->program_counter -= 2;
+            break;
+        case 0x00FE:
+        case 0x00FF:
+            // switching resolution clears the screen
+            state->hires = opcode == 0x00FF;
+            memset(state->video, 0, sizeof(state->video));
+            state->video_dirty = 1;
+            break;
+        default:
+            printf("Unknown opcode: 0x%X\n", opcode);
+            break;
+    }
+}
+
+// 8xy_ opcodes, shared with CHIP-8 through alu.h
+static inline void CORE(op_8xy_)(xchip_state *state, uint16_t opcode, uint8_t x, uint8_t y) {
+    uint8_t *v = state->v_register;
+    if (!alu_8xy(opcode & 0xF, &v[x], v[y], &v[0xF], C_SHIFT_VY)) {
+        printf("Unknown opcode: 0x%X\n", opcode);
+    }
+}
+
+// F___ opcodes
+static void CORE(op_F___)(xchip_state *state, uint16_t opcode, uint8_t x) {
+    uint8_t *v = state->v_register;
+    uint16_t index = state->index_register;
+
+    switch (opcode & 0x00FF) {
+#if CORE_XOCHIP
+        case 0x00:
+            // F000 nnnn: I = nnnn, the word after this instruction
+            if (x == 0) {
+                state->index_register = C_MEM(state, state->program_counter) << 8 | C_MEM(state, state->program_counter + 1);
+                state->program_counter += 2;
+                return;
+            }
+            break;
+        case 0x01:
+            // Fn01: draw, scroll and clear planes n
+            state->planes = x & 0x3;
+            return;
+        case 0x02:
+            // F002: load the 16-byte audio pattern from I
+            if (x == 0) {
+                for (int i = 0; i < XCHIP_AUDIO_PATTERN; ++i) {
+                    state->audio_pattern[i] = C_MEM(state, index + i);
+                }
+                return;
+            }
+            break;
+        case 0x3A:
+            state->pitch = v[x];
+            return;
+#endif
+        case 0x07:
+            v[x] = state->delay_timer;
+            return;
+        case 0x0A:
+            // wait for a key, storing the lowest one held in Vx
+            if (state->keys) {
+                v[x] = __builtin_ctz(state->keys);
+            } else {
+                state->program_counter -= 2;
+            }
+            return;
+        case 0x15:
+            state->delay_timer = v[x];
+            return;
+        case 0x18:
+            state->sound_timer = v[x];
+            return;
+        case 0x1E:
+            state->index_register += v[x];
+            return;
+        case 0x29:
+            state->index_register = FONT_OFFSET + 5 * (v[x] & 0xF);
+            return;
+        case 0x30:
+            state->index_register = BIG_FONT_OFFSET + 10 * (v[x] & 0xF);
+            return;
+        case 0x33:
+            C_MEM(state, index) = v[x] / 100;
+            C_MEM(state, index + 1) = v[x] / 10 % 10;
+            C_MEM(state, index + 2) = v[x] % 10;
+            return;
+        case 0x55:
+            for (int i = 0; i <= x; ++i) {
+                C_MEM(state, index + i) = v[i];
+            }
+#if C_LOAD_STORE_MOVES_I
+            state->index_register += x + 1;
+#endif
+            return;
+        case 0x65:
+            for (int i = 0; i <= x; ++i) {
+                v[i] = C_MEM(state, index + i);
+            }
+#if C_LOAD_STORE_MOVES_I
+            state->index_register += x + 1;
+#endif
+            return;
+        case 0x75:
+            memcpy(state->flags, v, (x & (C_NUM_FLAGS - 1)) + 1);
+            return;
+        case 0x85:
+            memcpy(v, state->flags, (x & (C_NUM_FLAGS - 1)) + 1);
+            return;
+    }
+    printf("Unknown opcode: 0x%X\n", opcode);
+}
+
+// Fetch and execute one instruction
+static inline __attribute__((always_inline)) void CORE(step)(xchip_state *state) {
+    uint16_t pc = state->program_counter;
+    uint16_t opcode = C_MEM(state, pc) << 8 | C_MEM(state, pc + 1);
+    uint8_t x = (opcode >> 8) & 0xF;
+    uint8_t y = (opcode >> 4) & 0xF;
+    uint8_t kk = opcode & 0xFF;
+    uint16_t nnn = opcode & 0xFFF;
+    uint8_t *v = state->v_register;
+
+    state->opcode = opcode;
+    state->program_counter = pc + 2;
+
+    switch (opcode >> 12) {
+        case 0x0:
+            CORE(op_00__)(state, opcode);
+            break;
+        case 0x1:
+            state->program_counter = nnn;
+            break;
+        case 0x2:
+            state->stack[state->stack_pointer & STACK_MASK] = state->program_counter;
+            ++state->stack_pointer;
+            state->program_counter = nnn;
+            break;
+        case 0x3:
+            if (v[x] == kk) {
+                CORE(skip)(state);
+            }
+            break;
+        case 0x4:
+            if (v[x] != kk) {
+                CORE(skip)(state);
+            }
+            break;
+        case 0x5:
+            switch (opcode & 0xF) {
+                case 0x0:
+                    if (v[x] == v[y]) {
+                        CORE(skip)(state);
+                    }
+                    break;
+#if CORE_XOCHIP
+                case 0x2:
+                    // save Vx..Vy at I, in either order, I unchanged
+                    for (int i = 0, step = x <= y ? 1 : -1; i <= abs(y - x); ++i) {
+                        C_MEM(state, state->index_register + i) = v[x + i * step];
+                    }
+                    break;
+                case 0x3:
+                    // load Vx..Vy from I
+                    for (int i = 0, step = x <= y ? 1 : -1; i <= abs(y - x); ++i) {
+                        v[x + i * step] = C_MEM(state, state->index_register + i);
+                    }
+                    break;
+#endif
+                default:
+                    printf("Unknown opcode: 0x%X\n", opcode);
+                    break;
+            }
+            break;
+        case 0x6:
+            v[x] = kk;
+            break;
+        case 0x7:
+            v[x] += kk;
+            break;
+        case 0x8:
+            CORE(op_8xy_)(state, opcode, x, y);
+            break;
+        case 0x9:
+            if (v[x] != v[y]) {
+                CORE(skip)(state);
+            }
+            break;
+        case 0xA:
+            state->index_register = nnn;
+            break;
+        case 0xB:
+            state->program_counter = nnn + v[C_JUMP_VX ? x : 0];
+            break;
+        case 0xC:
+            v[x] = alu_random_byte(&state->rng_state) & kk;
+            break;
+        case 0xD:
+            CORE(op_Dxyn)(state, x, y, opcode & 0xF);
+            break;
+        case 0xE:
+            if (kk == 0x9E) {
+                if (state->keys >> (v[x] & KEY_MASK) & 1) {
+                    CORE(skip)(state);
+                }
+            } else if (kk == 0xA1) {
+                if (!(state->keys >> (v[x] & KEY_MASK) & 1)) {
+                    CORE(skip)(state);
+                }
+            } else {
+                printf("Unknown opcode: 0x%X\n", opcode);
+            }
+            break;
+        case 0xF:
+            CORE(op_F___)(state, opcode, x);
+            break;
+    }
+}
+
+uint64_t CORE(run)(xchip_state *state, uint64_t cycles) {
+    for (uint64_t done = 0; done < cycles; ++done) {
+        CORE(step)(state);
+    }
+    return cycles;
+}
+
+#undef C_ADDRESS_MASK
+#undef C_NUM_FLAGS
+#undef C_SHIFT_VY
+#undef C_LOAD_STORE_MOVES_I
+#undef C_JUMP_VX
+#undef C_WRAP_SPRITES
+#undef C_MEM